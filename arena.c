@@ -0,0 +1,187 @@
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "arena.h"
+
+#define HUGE_PAGE (2L << 20)
+
+typedef struct chunk {
+  struct chunk* next;
+  long size;            // bytes mapped, including this header
+  long used;            // bytes handed out, including this header
+} chunk;
+
+struct arena {
+  pthread_mutex_t lock;
+  int flags;
+  long chunk_size;      // size of the next chunk
+  long allocated;       // sum of requests
+  chunk* chunks;        // current chunk first
+};
+
+static arena* run_arena = 0;
+
+
+static long page_size() {
+  static long size = 0;
+  if (!size) {
+    size = sysconf(_SC_PAGESIZE);
+  }
+  return size;
+}
+
+static chunk* map_chunk(long size, int flags) {
+
+  void* p = MAP_FAILED;
+
+  if (flags & ARENA_HUGEPAGES) {
+    size = (size + HUGE_PAGE - 1) / HUGE_PAGE * HUGE_PAGE;
+    // reserved huge pages if the system has enough.  No MAP_NORESERVE
+    // here: the mapping must fail now, not SIGBUS when the pool runs dry.
+    p = mmap(0, size, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  } else {
+    size = (size + page_size() - 1) / page_size() * page_size();
+  }
+
+  if (p == MAP_FAILED) {
+    p = mmap(0, size, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED) {
+      perror("Cannot map arena");
+      return 0;
+    }
+    if (flags & ARENA_HUGEPAGES) {
+      // else transparent huge pages, which the kernel may or may not give
+      madvise(p, size, MADV_HUGEPAGE);
+    }
+  }
+
+  chunk* c = (chunk*)p;
+  c->next = 0;
+  c->size = size;
+  c->used = (sizeof(chunk) + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+  return c;
+}
+
+arena* arena_create(long reserve, int flags) {
+
+  arena* a = malloc(sizeof(arena));
+  if (!a) {
+    perror("Not enough memory");
+    return 0;
+  }
+
+  pthread_mutex_init(&a->lock, 0);
+  a->flags = flags;
+  a->chunk_size = reserve > 0 ? reserve : ARENA_CHUNK;
+  a->allocated = 0;
+  if (!(a->chunks = map_chunk(a->chunk_size, flags))) {
+    free(a);
+    return 0;
+  }
+  return a;
+}
+
+void arena_destroy(arena* a) {
+  if (!a) {
+    return;
+  }
+  if (run_arena == a) {
+    run_arena = 0;
+  }
+  chunk* c = a->chunks;
+  while (c) {
+    chunk* next = c->next;
+    munmap(c, c->size);
+    c = next;
+  }
+  pthread_mutex_destroy(&a->lock);
+  free(a);
+}
+
+void* arena_alloc(arena* a, long bytes) {
+
+  long align = bytes >= page_size() ? page_size() : ARENA_ALIGN;
+
+  pthread_mutex_lock(&a->lock);
+
+  chunk* c = a->chunks;
+  long start = (c->used + align - 1) / align * align;
+
+  if (start + bytes > c->size) {
+    // new chunk, at least twice the last so big runs need few of them
+    long need = bytes + page_size() + sizeof(chunk);
+    a->chunk_size = 2 * a->chunk_size > need ? 2 * a->chunk_size : need;
+    chunk* fresh = map_chunk(a->chunk_size, a->flags);
+    if (!fresh) {
+      pthread_mutex_unlock(&a->lock);
+      return 0;
+    }
+    fresh->next = a->chunks;
+    a->chunks = c = fresh;
+    start = (c->used + align - 1) / align * align;
+  }
+
+  c->used = start + bytes;
+  a->allocated += bytes;
+
+  pthread_mutex_unlock(&a->lock);
+
+  return (char*)c + start;
+}
+
+int arena_owns(arena* a, void* p) {
+  if (!a) {
+    return 0;
+  }
+  pthread_mutex_lock(&a->lock);
+  int owns = 0;
+  for (chunk* c = a->chunks; c && !owns; c = c->next) {
+    owns = (char*)p >= (char*)c && (char*)p < (char*)c + c->size;
+  }
+  pthread_mutex_unlock(&a->lock);
+  return owns;
+}
+
+long arena_used(arena* a) {
+  return a->allocated;
+}
+
+void arena_set_run(arena* a) {
+  run_arena = a;
+}
+
+arena* arena_run() {
+  return run_arena;
+}
+
+void* run_alloc(long bytes) {
+
+  void* p;
+  if (run_arena) {
+    p = arena_alloc(run_arena, bytes);
+  } else {
+    // aligned_alloc wants a multiple of the alignment
+    long align = bytes >= page_size() ? page_size() : ARENA_ALIGN;
+    p = aligned_alloc(align, (bytes + align - 1) / align * align);
+  }
+
+  // callers don't check, a run can't go on without its buffers
+  if (!p) {
+    perror("Not enough memory");
+    exit(-1);
+  }
+  return p;
+}
+
+void run_free(void* p) {
+  if (p && !arena_owns(run_arena, p)) {
+    free(p);
+  }
+}
@@ -0,0 +1,54 @@
+#ifndef _arena
+#define _arena
+
+/*
+ *  Per-run memory arena
+ *
+ *  One arena holds everything a run allocates: the signal, the filter
+ *  coefficient banks, the per-thread result slots and scratch.  Memory is
+ *  handed out by bumping a pointer through large mmap()ed chunks, always
+ *  64-byte (cache line) aligned, page aligned for anything of a page or
+ *  more, and is all released at once by arena_destroy.  Nothing is freed
+ *  piecemeal, so threads never contend in malloc for it.
+ *
+ *  Typical use
+ *
+ *   arena* a = arena_create(0, ARENA_HUGEPAGES);
+ *   arena_set_run(a);      // library allocations now come from a
+ *   ... load the signal, scan ...
+ *   arena_set_run(0);
+ *   arena_destroy(a);
+ *
+ *  Library code allocates with run_alloc/run_free, which fall back to
+ *  aligned_alloc/free when no run arena is set.  Programs using arenas
+ *  must be built with -pthread.
+ */
+
+#define ARENA_ALIGN     64         // cache line, and a full AVX-512 vector
+#define ARENA_CHUNK     (64L << 20) // default chunk size, grows as needed
+
+#define ARENA_HUGEPAGES 0x1        // back the arena with huge pages if possible
+
+typedef struct arena arena;
+
+// reserve is the first chunk size (0 = ARENA_CHUNK).  Pages are only
+// committed as they are used.  Returns 0 if the memory can't be mapped.
+arena* arena_create(long reserve, int flags);
+void   arena_destroy(arena* a);
+
+// ARENA_ALIGN aligned, page aligned if bytes >= a page.  Thread safe.
+void*  arena_alloc(arena* a, long bytes);
+int    arena_owns(arena* a, void* p);
+long   arena_used(arena* a);       // bytes handed out so far
+
+// The arena the library allocates from for the current run (0 = none)
+void   arena_set_run(arena* a);
+arena* arena_run();
+
+// From the run arena if there is one, else aligned_alloc.  Never
+// returns 0: out of memory is reported and the program exits.  run_free
+// ignores memory in the run arena, it is released with the arena.
+void*  run_alloc(long bytes);
+void   run_free(void* p);
+
+#endif
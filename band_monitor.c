@@ -0,0 +1,362 @@
+#define _GNU_SOURCE
+#include <sched.h>    // for processor affinity
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <math.h>
+#include <assert.h>
+
+#include "filter.h"
+#include "timing.h"
+#include "report.h"
+
+#define DEFAULT_BLOCK  4096   // samples per block, ~10 ms at 400 kHz
+#define DEFAULT_WINDOW 0.1    // seconds of signal each power estimate covers
+#define CACHE_LINE 64
+#define SLOT_ROUND (CACHE_LINE / sizeof(double))  // doubles per cache line
+
+/*
+ * Live band power monitor.
+ *
+ * Reads a stream of binary samples (same format as the .bin signal files)
+ * from stdin or a file/FIFO, runs the band pass filter bank over it one
+ * block at a time, and keeps a running power per band over a sliding
+ * window, either a boxcar (the sum of the last window's worth of blocks)
+ * or an exponential average with the same time constant (applied a block
+ * at a time, which for blocks much shorter than the window is the same
+ * thing).  The DC level is tracked with an exponential average over the
+ * same window.
+ *
+ * Each block's band powers come from the fused convolve-and-power
+ * kernels, the bands dealt out round-robin to num_threads threads pinned
+ * to processors 0 .. num_processors - 1 (-p).  The threads live for the
+ * whole stream and meet at a barrier before and after every block.  The
+ * final line gives the processing rate against Fs: below 1x real time
+ * the monitor falls behind a live source.
+ *
+ * After each block, every band in the alien window is compared against
+ * THRESHOLD times the average band power, just like band_scan, and an
+ * event is printed whenever a band starts or stops being WOW.  Detection
+ * latency is one block plus however long the window needs to respond.
+ */
+
+typedef enum {BOXCAR, EMA} window_type;
+
+void usage() {
+  printf("usage: band_monitor [-w boxcar|ema] [-t window_seconds] [-b block_samples] [-p num_threads[:num_processors]] Fs filter_order num_bands [stream_file]\n"
+         "  reads binary samples from stream_file (or stdin) until end of stream\n"
+         "  -p  filter the bands on this many pinned threads (default 1)\n");
+}
+
+// The block being filtered, shared by all the band threads
+int filter_order;
+int num_bands;
+double* bank;             // one row of order+1 coefficients per band
+double* block_x;          // order samples of history, then the block
+int block_n;              // its length, 0 = stream over
+pthread_barrier_t block_start;
+pthread_barrier_t block_done;
+
+typedef struct inputs {
+  int id;
+  int num_threads;
+  int processor;
+  double* slot;           // block powers of bands id, id + num_threads, ...
+} __attribute__((aligned(CACHE_LINE))) inputs;
+
+static void pin(int processor) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(processor, &set);
+  if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+    perror("Can't setaffinity");
+    exit(-1);
+  }
+}
+
+// This thread's bands of the current block
+static void filter_block(inputs* in) {
+  int mine = 0;
+  for (int band = in->id; band < num_bands; band += in->num_threads) {
+    convolve_continue_and_compute_power(block_n, block_x + filter_order, filter_order,
+                                        bank + (long)band * (filter_order + 1),
+                                        &in->slot[mine++]);
+  }
+}
+
+// Threads 1 .. num_threads - 1; the main thread is thread 0
+static void* worker(void* arg) {
+  inputs* in = (inputs*)arg;
+
+  pin(in->processor);
+  for (;;) {
+    pthread_barrier_wait(&block_start);
+    if (block_n == 0) {
+      break;
+    }
+    filter_block(in);
+    pthread_barrier_wait(&block_done);
+  }
+
+  pthread_exit(NULL);
+}
+
+// Read up to num samples, waiting for more until the stream ends
+int read_block(int fd, double* dest, int num) {
+
+  char* cur = (char*)dest;
+  int left  = num * sizeof(double);
+
+  while (left > 0) {
+    int thisread = read(fd, cur, left);
+    if (thisread < 0) {
+      perror("Read failure");
+      return -1;
+    }
+    if (thisread == 0) {
+      break; // end of stream
+    }
+    cur  += thisread;
+    left -= thisread;
+  }
+
+  return (num * sizeof(double) - left) / sizeof(double);
+}
+
+int main(int argc, char* argv[]) {
+
+  window_type wtype = BOXCAR;
+  double window_secs = DEFAULT_WINDOW;
+  int block = DEFAULT_BLOCK;
+  int num_threads = 1;
+  int num_processors = sysconf(_SC_NPROCESSORS_ONLN);
+
+  int opt;
+  while ((opt = getopt(argc, argv, "w:t:b:p:h")) != -1) {
+    switch (opt) {
+      case 'w':
+        if (!strcmp(optarg, "boxcar")) {
+          wtype = BOXCAR;
+        } else if (!strcmp(optarg, "ema")) {
+          wtype = EMA;
+        } else {
+          usage();
+          return -1;
+        }
+        break;
+      case 't':
+        window_secs = atof(optarg);
+        break;
+      case 'b':
+        block = atoi(optarg);
+        break;
+      case 'p':
+        if (sscanf(optarg, "%d:%d", &num_threads, &num_processors) < 1 ||
+            num_threads <= 0 || num_processors <= 0) {
+          usage();
+          return -1;
+        }
+        break;
+      default:
+        usage();
+        return -1;
+    }
+  }
+
+  if (argc - optind < 3 || argc - optind > 4) {
+    usage();
+    return -1;
+  }
+
+  double Fs        = atof(argv[optind]);
+  filter_order     = atoi(argv[optind + 1]);
+  num_bands        = atoi(argv[optind + 2]);
+  char* stream     = argc - optind == 4 ? argv[optind + 3] : 0;
+
+  assert(Fs > 0.0);
+  assert(filter_order > 0 && !(filter_order & 0x1));
+  assert(num_bands > 0);
+  assert(block > 0 && window_secs > 0);
+
+  int fd = 0;
+  if (stream && (fd = open(stream, O_RDONLY)) < 0) {
+    perror("Cannot open stream");
+    return -1;
+  }
+
+  double bandwidth = (Fs / 2) / num_bands;
+  long window = (long)(window_secs * Fs);                  // in samples
+  int window_blocks = (window + block - 1) / block;        // boxcar length
+  double alpha = 1.0 / window;                             // EMA weight
+
+  printf("Fs:       %lf Hz\n\
+order:    %d\n\
+bands:    %d\n\
+block:    %d samples (%lf seconds)\n\
+window:   %s, %lf seconds\n\
+threads:  %d on %d processors\n",
+         Fs, filter_order, num_bands, block, block / Fs,
+         wtype == BOXCAR ? "boxcar" : "exponential", window_secs,
+         num_threads, num_processors);
+
+  // filter bank, one row of order+1 coefficients per band
+  bank = malloc((long)num_bands * (filter_order + 1) * sizeof(double));
+  for (int band = 0; band < num_bands; band++) {
+    double* c = bank + band * (filter_order + 1);
+    generate_band_pass(Fs,
+                       BAND_LOW(band, bandwidth),
+                       BAND_HIGH(band, bandwidth),
+                       filter_order,
+                       c);
+    hamming_window(filter_order, c);
+  }
+
+  // order samples of history followed by the current block
+  double* buf    = calloc(filter_order + block, sizeof(double));
+  double* raw    = malloc(block * sizeof(double));
+  double* power  = calloc(num_bands, sizeof(double));   // current estimate
+  double* ring   = calloc((long)num_bands * window_blocks, sizeof(double)); // boxcar block sums
+  double* ringsum = calloc(num_bands, sizeof(double));
+  int* wow       = calloc(num_bands, sizeof(int));
+
+  // each thread's block powers in whole cache lines of its own
+  int per_thread = (num_bands + num_threads - 1) / num_threads;
+  int stride = (per_thread + SLOT_ROUND - 1) / SLOT_ROUND * SLOT_ROUND;
+  double* slots = aligned_alloc(CACHE_LINE, (long)num_threads * stride * sizeof(double));
+  inputs* thread_inputs = aligned_alloc(CACHE_LINE, num_threads * sizeof(inputs));
+  pthread_t* tid = malloc(num_threads * sizeof(pthread_t));
+  assert(bank && buf && raw && power && ring && ringsum && wow && slots && thread_inputs && tid);
+
+  block_x = buf;
+  pthread_barrier_init(&block_start, NULL, num_threads);
+  pthread_barrier_init(&block_done, NULL, num_threads);
+  for (int i = 0; i < num_threads; i++) {
+    thread_inputs[i].id = i;
+    thread_inputs[i].num_threads = num_threads;
+    thread_inputs[i].processor = i % num_processors;
+    thread_inputs[i].slot = slots + (long)i * stride;
+    if (i > 0 && pthread_create(&tid[i], NULL, worker, &thread_inputs[i]) != 0) {
+      perror("Failed to start thread");
+      exit(-1);
+    }
+  }
+  pin(thread_inputs[0].processor);
+
+  double dc = 0;
+  long seen = 0;     // samples consumed so far
+  long blocks = 0;
+  long events = 0;
+  double start = get_seconds();
+  double busy = 0;   // seconds spent on blocks, not waiting for the stream
+  int n;
+
+  while ((n = read_block(fd, raw, block)) > 0) {
+
+    double block_started = get_seconds();
+
+    // running DC removal
+    double* x = buf + filter_order;
+    for (int i = 0; i < n; i++) {
+      dc = seen + i == 0 ? raw[i] : dc + alpha * (raw[i] - dc);
+      x[i] = raw[i] - dc;
+    }
+
+    // all threads filter their bands of the block
+    block_n = n;
+    pthread_barrier_wait(&block_start);
+    filter_block(&thread_inputs[0]);
+    pthread_barrier_wait(&block_done);
+
+    int slot = blocks % window_blocks;
+    double decay = pow(1 - alpha, n);     // EMA weight left after n samples
+    for (int band = 0; band < num_bands; band++) {
+      double p = slots[(long)(band % num_threads) * stride + band / num_threads];
+
+      if (wtype == BOXCAR) {
+        double sum = p * n;
+        double* r = ring + (long)band * window_blocks;
+        ringsum[band] += sum - r[slot];
+        r[slot] = sum;
+        long covered = seen + n < window_blocks * (long)block ? seen + n : window_blocks * (long)block;
+        power[band] = ringsum[band] / covered;
+      } else {
+        power[band] = decay * power[band] + (1 - decay) * p;
+      }
+    }
+
+    seen += n;
+    blocks++;
+
+    // keep the tail as history for the next block
+    memmove(buf, buf + n, filter_order * sizeof(double));
+
+    if (seen < window) {
+      busy += get_seconds_diff(block_started);
+      continue; // still warming up
+    }
+
+    double avg = 0;
+    for (int band = 0; band < num_bands; band++) {
+      avg += power[band];
+    }
+    avg /= num_bands;
+
+    for (int band = 0; band < num_bands; band++) {
+      double band_low  = BAND_LOW(band, bandwidth);
+      double band_high = BAND_HIGH(band, bandwidth);
+
+      if (!in_alien_window(band_low, band_high)) {
+        continue;
+      }
+
+      int now = power[band] > THRESHOLD * avg;
+      if (now != wow[band]) {
+        wow[band] = now;
+        events++;
+        printf("%12.6f s (sample %ld, wall %.6f): band %5d %lf to %lf Hz power %lf avg %lf %s\n",
+               seen / Fs, seen, get_seconds(), band, band_low, band_high,
+               power[band], avg, now ? "WOW start" : "WOW end");
+        fflush(stdout);
+      }
+    }
+    busy += get_seconds_diff(block_started);
+  }
+
+  // let the threads go
+  block_n = 0;
+  pthread_barrier_wait(&block_start);
+  for (int i = 1; i < num_threads; i++) {
+    if (pthread_join(tid[i], NULL) != 0) {
+      perror("join failed");
+      exit(-1);
+    }
+  }
+  pthread_barrier_destroy(&block_start);
+  pthread_barrier_destroy(&block_done);
+
+  double elapsed = get_seconds_diff(start);
+  double rate = busy > 0 ? seen / busy : 0;
+  printf("Monitored %ld samples (%lf seconds of signal) in %lf seconds, %ld events, "
+         "%.0lf samples/s processing (%.2lfx real time at Fs)\n",
+         seen, seen / Fs, elapsed, events, rate, rate / Fs);
+
+  if (stream) {
+    close(fd);
+  }
+
+  free(bank);
+  free(buf);
+  free(raw);
+  free(slots);
+  free(thread_inputs);
+  free(tid);
+  free(power);
+  free(ring);
+  free(ringsum);
+  free(wow);
+
+  return n < 0 ? -1 : 0;
+}
@@ -1,19 +1,31 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <ctype.h>
+#include <unistd.h>
 #include <assert.h>
+#include <math.h>
 
 #include "filter.h"
 #include "signal.h"
 #include "timing.h"
+#include "report.h"
 
-#define MAXWIDTH 40
-#define THRESHOLD 2.0
-#define ALIENS_LOW  50000.0
-#define ALIENS_HIGH 150000.0
+report_format out_format = REPORT_TEXT; // -f: structured results as well
+char* out_path = 0;     // -o: where they go (stdout if not given)
+int out_fd = -1;
+filter_spec design = {DESIGN_HAMMING, 0, 0}; // -D: filters by specification
+int use_design = 0;
+int iq = 0;             // -q: the file holds I/Q pairs
 
 void usage() {
-  printf("usage: band_scan text|bin|mmap signal_file Fs filter_order num_bands\n");
+  printf("usage: band_scan [-f text|json|csv|bin] [-o file] [-D hamming|kaiser|remez[:atten[:transition]]] [-q] text|bin|mmap signal_file Fs filter_order num_bands\n"
+         "  -f  also write machine readable results (see report.h)\n"
+         "  -o  write them to file instead of stdout (else text goes to stderr)\n"
+         "  -D  design the filters for atten dB (default 60) with this transition\n"
+         "      width in Hz (default one band), at the smallest order that meets\n"
+         "      it; filter_order is then ignored\n"
+         "  -q  the file is a complex capture, I and Q interleaved: scan\n"
+         "      -Fs/2..Fs/2 with Hamming low passes on the mixed down bands\n");
 }
 
 double avg_power(double* data, int num) {
@@ -73,11 +85,19 @@ void remove_dc(double* data, int num) {
 int analyze_signal(signal* sig, int filter_order, int num_bands, double* lb, double* ub) {
 
   double Fc        = (sig->Fs) / 2;
-  double bandwidth = Fc / num_bands;
-
-  remove_dc(sig->data,sig->num_samples);
-
-  double signal_power = avg_power(sig->data,sig->num_samples);
+  double bandwidth = sig->iq ? 2 * Fc / num_bands : Fc / num_bands;
+
+  // I/Q: the DC (complex) is taken out by the mixer instead
+  signal_stats i_stats, q_stats;
+  double signal_power;
+  if (sig->iq) {
+    iq_signal_statistics(sig->data, sig->num_samples, &i_stats, &q_stats);
+    printf("Removing DC component of %lf + %lf j\n", i_stats.mean, q_stats.mean);
+    signal_power = i_stats.power + q_stats.power;
+  } else {
+    remove_dc(sig->data,sig->num_samples);
+    signal_power = avg_power(sig->data,sig->num_samples);
+  }
 
   printf("signal average power:     %lf\n", signal_power);
 
@@ -89,13 +109,25 @@ int analyze_signal(signal* sig, int filter_order, int num_bands, double* lb, dou
   double filter_coeffs[filter_order + 1];
   double band_power[num_bands];
   for (int band = 0; band < num_bands; band++) {
+    if (sig->iq) {
+      // Mix the band center down to 0 Hz and low pass it
+      double omega = M_PI * (BAND_LOW(band, bandwidth) + BAND_HIGH(band, bandwidth)) / sig->Fs;
+      generate_low_pass(sig->Fs, bandwidth / 2 - 0.0001, filter_order, filter_coeffs);
+      hamming_window(filter_order, filter_coeffs);
+      convolve_iq_and_compute_power(sig->num_samples, sig->data,
+                                    i_stats.mean, q_stats.mean, omega,
+                                    filter_order, filter_coeffs,
+                                    &(band_power[band]));
+      continue;
+    }
+
     // Make the filter
-    generate_band_pass(sig->Fs,
-                       band * bandwidth + 0.0001, // keep within limits
-                       (band + 1) * bandwidth - 0.0001,
-                       filter_order,
-                       filter_coeffs);
-    hamming_window(filter_order,filter_coeffs);
+    design_band_pass(&design,
+                     sig->Fs,
+                     band * bandwidth + 0.0001, // keep within limits
+                     (band + 1) * bandwidth - 0.0001,
+                     filter_order,
+                     filter_coeffs);
 
     // Convolve
     convolve_and_compute_power(sig->num_samples,
@@ -116,75 +148,70 @@ int analyze_signal(signal* sig, int filter_order, int num_bands, double* lb, dou
   get_resources_diff(&rstart, &rend, &rdiff);
 
   // Pretty print results
-  double max_band_power = max_of(band_power,num_bands);
   double avg_band_power = avg_of(band_power,num_bands);
-  int wow = 0;
-  *lb = -1;
-  *ub = -1;
-
-  for (int band = 0; band < num_bands; band++) {
-    double band_low  = band * bandwidth + 0.0001;
-    double band_high = (band + 1) * bandwidth - 0.0001;
-
-    printf("%5d %20lf to %20lf Hz: %20lf ",
-           band, band_low, band_high, band_power[band]);
-
-    for (int i = 0; i < MAXWIDTH * (band_power[band] / max_band_power); i++) {
-      printf("*");
-    }
-
-    if ((band_low >= ALIENS_LOW && band_low <= ALIENS_HIGH) ||
-        (band_high >= ALIENS_LOW && band_high <= ALIENS_HIGH)) {
-
-      // band of interest
-      if (band_power[band] > THRESHOLD * avg_band_power) {
-        printf("(WOW)");
-        wow = 1;
-        if (*lb < 0) {
-          *lb = band * bandwidth + 0.0001;
-        }
-        *ub = (band + 1) * bandwidth - 0.0001;
-      } else {
-        printf("(meh)");
-      }
-    } else {
-      printf("(meh)");
-    }
+  int wow = report_bands(num_bands, bandwidth, band_power, avg_band_power, lb, ub);
 
-    printf("\n");
-  }
-
-  printf("Resource usages:\n\
-User time        %lf seconds\n\
-System time      %lf seconds\n\
-Page faults      %ld\n\
-Page swaps       %ld\n\
-Blocks of I/O    %ld\n\
-Signals caught   %ld\n\
-Context switches %ld\n",
-         rdiff.usertime,
-         rdiff.systime,
-         rdiff.pagefaults,
-         rdiff.pageswaps,
-         rdiff.ioblocks,
-         rdiff.sigs,
-         rdiff.contextswitches);
+  report_resources(&rdiff);
 
   printf("Analysis took %llu cycles (%lf seconds) by cycle count, timing overhead=%llu cycles\n"
          "Note that cycle count only makes sense if the thread stayed on one core\n",
          tend - tstart, cycles_to_seconds(tend - tstart), timing_overhead());
   printf("Analysis took %lf seconds by basic timing\n", end - start);
 
+  if (out_format != REPORT_TEXT) {
+    report_record r = {.num_bands = num_bands, .filter_order = filter_order,
+                       .num_samples = sig->num_samples, .wow = wow,
+                       .Fs = sig->Fs, .bandwidth = bandwidth,
+                       .signal_power = signal_power, .avg_band_power = avg_band_power,
+                       .lb = *lb, .ub = *ub, .seconds = end - start,
+                       .cycles = tend - tstart, .rusage = rdiff};
+    report_structured(out_fd, out_format, &r, band_power);
+  }
+
   return wow;
 }
 
 int main(int argc, char* argv[]) {
 
+  int opt;
+  while ((opt = getopt(argc, argv, "f:o:D:qh")) != -1) {
+    switch (opt) {
+      case 'f':
+        if ((int)(out_format = report_format_of(optarg)) < 0) {
+          usage();
+          return -1;
+        }
+        break;
+      case 'o':
+        out_path = optarg;
+        break;
+      case 'D':
+        if (filter_spec_of(optarg, &design)) {
+          usage();
+          return -1;
+        }
+        use_design = 1;
+        break;
+      case 'q':
+        iq = 1;
+        break;
+      default:
+        usage();
+        return -1;
+    }
+  }
+  argc -= optind - 1;
+  argv += optind - 1;
+
   if (argc != 6) {
     usage();
     return -1;
   }
 
+  if (out_format != REPORT_TEXT && (out_fd = report_open(out_path)) < 0) {
+    return -1;
+  }
+
   char sig_type    = toupper(argv[1][0]);
   char* sig_file   = argv[2];
   double Fs        = atof(argv[3]);
@@ -192,9 +219,28 @@ int main(int argc, char* argv[]) {
   int num_bands    = atoi(argv[5]);
 
   assert(Fs > 0.0);
-  assert(filter_order > 0 && !(filter_order & 0x1));
   assert(num_bands > 0);
 
+  if (iq && use_design) {
+    printf("-q filters are Hamming low passes, -D does not apply\n");
+    return -1;
+  }
+
+  if (use_design) {
+    double bandwidth = Fs / 2 / num_bands;
+    if (design.transition <= 0) {
+      design.transition = bandwidth;
+    }
+    filter_order = design_min_order(&design, Fs, BAND_LOW(num_bands / 2, bandwidth),
+                                    BAND_HIGH(num_bands / 2, bandwidth));
+    if (filter_order < 0) {
+      printf("No filter up to order %d meets %lf dB with a %lf Hz transition\n",
+             DESIGN_MAX_ORDER, design.atten, design.transition);
+      return -1;
+    }
+  }
+  assert(filter_order > 0 && !(filter_order & 0x1));
+
   printf("type:     %s\n\
 file:     %s\n\
 Fs:       %lf Hz\n\
@@ -205,6 +251,10 @@ bands:    %d\n",
          Fs,
          filter_order,
          num_bands);
+  if (use_design) {
+    printf("design:   %lf dB, %lf Hz transition\n",
+           design.design == DESIGN_HAMMING ? 53.0 : design.atten, design.transition);
+  }
 
   printf("Load or map file\n");
 
@@ -233,6 +283,13 @@ bands:    %d\n",
   }
 
   sig->Fs = Fs;
+  if (iq) {
+    if (signal_to_iq(sig)) {
+      printf("An I/Q file needs an even number of values\n");
+      return -1;
+    }
+    report_band_origin(-Fs / 2);
+  }
 
   double start = 0;
   double end   = 0;
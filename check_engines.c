@@ -0,0 +1,395 @@
+#include <math.h>
+#include <complex.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "filter.h"
+#include "signal.h"
+#include "report.h"
+#include "scan.h"
+#include "fft.h"
+
+/*
+ * Consistency checks for the band power engines (make check).
+ *
+ * A short signal is generated: white noise, DC, a weak tone below the
+ * alien window and a strong one in it, at the center of a band.  The
+ * reference is the Hamming bank run through convolve_and_compute_power
+ * by the generic kernels; each engine's band powers are compared with
+ * it within the tolerance given for it:
+ *
+ *   - exact engines (other kernels, FFT, designs, I/Q) to rounding,
+ *   - the pre-screen's bounds must contain the reference, and be tight,
+ *   - sampled estimates must be within their confidence intervals,
+ *   - approximate engines (Welch, IIR, baseband) on the bands that
+ *     matter, the tone band and the band average, within a few percent,
+ *   - tone detectors against the tone's known power.
+ *
+ * The same signals are written to check_alien.bin, check_quiet.bin and
+ * check_iq.bin for the Makefile to run p_band_scan's detection paths and
+ * tone_scan on.  Exits non-zero if anything is out of tolerance.
+ */
+
+#define CHECK_FS       400000.0
+#define CHECK_SAMPLES  32768
+#define CHECK_ORDER    64
+#define CHECK_BANDS    32
+#define CHECK_THREADS  2
+#define SHARP_ORDER    256         // the reference for engines that approximate the ideal band
+#define CHECK_BAND     16          // in the alien window; the tone is at its center
+#define NOISE          0.2         // peak to peak
+
+int failures = 0;
+
+void verdict(char* what, double err, double tol) {
+  int ok = err <= tol;
+  printf("%-44s %s  (error %.3g, tolerance %.3g)\n", what, ok ? "ok" : "FAIL", err, tol);
+  failures += !ok;
+}
+
+// Worst band error relative to the reference band power, floored at a
+// thousandth of the average so near-empty bands aren't held to digits
+// they don't have
+double band_error(double* got, double* want, int num_bands) {
+  double avg = 0;
+  for (int b = 0; b < num_bands; b++) {
+    avg += want[b] / num_bands;
+  }
+  double worst = 0;
+  for (int b = 0; b < num_bands; b++) {
+    double err = fabs(got[b] - want[b]) / (fabs(want[b]) + 1e-3 * avg);
+    worst = err > worst ? err : worst;
+  }
+  return worst;
+}
+
+double relative(double got, double want) {
+  return fabs(got - want) / fabs(want);
+}
+
+double average(double* power, int num_bands) {
+  double sum = 0;
+  for (int b = 0; b < num_bands; b++) {
+    sum += power[b];
+  }
+  return sum / num_bands;
+}
+
+// Uniform in -0.5..0.5, the same on every machine
+double noise() {
+  static unsigned long state = 12345;
+  state = state * 6364136223846793005UL + 1442695040888963407UL;
+  return (double)(state >> 11) / (double)(1UL << 53) - 0.5;
+}
+
+signal* make_signal(double tone_hz, double amplitude) {
+  signal* sig = allocate_signal(CHECK_SAMPLES, CHECK_FS, 0);
+  for (int n = 0; n < CHECK_SAMPLES; n++) {
+    sig->data[n] = 0.25 + NOISE * noise() +
+                   0.3 * cos(2 * M_PI * 20000.0 * n / CHECK_FS) +
+                   amplitude * cos(2 * M_PI * tone_hz * n / CHECK_FS + 0.3);
+  }
+  return sig;
+}
+
+// I/Q: a complex tone at +tone_hz, a weak one at -30 kHz
+signal* make_iq_signal(double tone_hz) {
+  signal* sig = allocate_signal(2 * CHECK_SAMPLES, CHECK_FS, 0);
+  for (int n = 0; n < CHECK_SAMPLES; n++) {
+    double complex z = 0.1 + 0.05 * I +
+                       NOISE * (noise() + I * noise()) +
+                       cexp(I * 2 * M_PI * tone_hz * n / CHECK_FS) +
+                       0.3 * cexp(-I * 2 * M_PI * 30000.0 * n / CHECK_FS);
+    sig->data[2 * n] = creal(z);
+    sig->data[2 * n + 1] = cimag(z);
+  }
+  return sig;
+}
+
+// The reference: band pass of the current design at order, less dc
+void reference_powers(signal* sig, double dc, filter_spec* spec, int order,
+                      double bandwidth, double* power) {
+  double* x = malloc(sig->num_samples * sizeof(double));
+  double* coeffs = malloc((order + 1) * sizeof(double));
+  for (int n = 0; n < sig->num_samples; n++) {
+    x[n] = sig->data[n] - dc;
+  }
+  for (int b = 0; b < CHECK_BANDS; b++) {
+    design_band_pass(spec, sig->Fs, BAND_LOW(b, bandwidth), BAND_HIGH(b, bandwidth),
+                     order, coeffs);
+    convolve_and_compute_power(sig->num_samples, x, order, coeffs, &power[b]);
+  }
+  free(coeffs);
+  free(x);
+}
+
+// The I/Q reference: each band center mixed down by cexp, sample by
+// sample, and the Hamming low pass of half the band width run on I and Q
+void reference_iq_powers(signal* sig, double dc_i, double dc_q, int order,
+                         double bandwidth, double* power) {
+  long N = sig->num_samples;
+  double* re = malloc(2 * N * sizeof(double));
+  double* im = re + N;
+  double* coeffs = malloc((order + 1) * sizeof(double));
+  for (int b = 0; b < CHECK_BANDS; b++) {
+    double low = BAND_LOW(b, bandwidth);
+    double high = BAND_HIGH(b, bandwidth);
+    double omega = M_PI * (low + high) / sig->Fs;
+    for (long n = 0; n < N; n++) {
+      double complex z = (sig->data[2 * n] - dc_i + I * (sig->data[2 * n + 1] - dc_q)) *
+                         cexp(-I * omega * n);
+      re[n] = creal(z);
+      im[n] = cimag(z);
+    }
+    generate_low_pass(sig->Fs, (high - low) / 2, order, coeffs);
+    hamming_window(order, coeffs);
+    double p_re, p_im;
+    convolve_and_compute_power(N, re, order, coeffs, &p_re);
+    convolve_and_compute_power(N, im, order, coeffs, &p_im);
+    power[b] = p_re + p_im;
+  }
+  free(coeffs);
+  free(re);
+}
+
+void scan_all(signal* sig, double dc, int order, double bandwidth, double* power) {
+  int bands[CHECK_BANDS];
+  for (int b = 0; b < CHECK_BANDS; b++) {
+    bands[b] = b;
+  }
+  scan_bands(sig, dc, order, bandwidth, power, bands, CHECK_BANDS, CHECK_THREADS, 0, 1);
+}
+
+int main(int argc, char* argv[]) {
+
+  double bandwidth = CHECK_FS / 2 / CHECK_BANDS;
+  double tone_hz = (BAND_LOW(CHECK_BAND, bandwidth) + BAND_HIGH(CHECK_BAND, bandwidth)) / 2;
+  filter_spec hamming = {DESIGN_HAMMING, 0, 0};
+
+  signal* sig = make_signal(tone_hz, 1.0);
+  signal_stats stats;
+  signal_statistics(sig->data, sig->num_samples, &stats);
+  double dc = stats.mean;
+
+  printf("check: %d samples at %.0f Hz, %d bands of order %d, tone at %.1f Hz\n",
+         CHECK_SAMPLES, CHECK_FS, CHECK_BANDS, CHECK_ORDER, tone_hz);
+
+  filter_use_isa("generic");
+  double want[CHECK_BANDS];
+  double got[CHECK_BANDS];
+  double extra[CHECK_BANDS];
+  reference_powers(sig, dc, &hamming, CHECK_ORDER, bandwidth, want);
+
+  // the kernels against the plain convolution they replace
+  {
+    double* x = malloc(2 * CHECK_SAMPLES * sizeof(double));
+    double* y = x + CHECK_SAMPLES;
+    double coeffs[CHECK_ORDER + 1];
+    for (int n = 0; n < CHECK_SAMPLES; n++) {
+      x[n] = sig->data[n] - dc;
+    }
+    generate_band_pass(CHECK_FS, BAND_LOW(CHECK_BAND, bandwidth),
+                       BAND_HIGH(CHECK_BAND, bandwidth), CHECK_ORDER, coeffs);
+    hamming_window(CHECK_ORDER, coeffs);
+    convolve(CHECK_SAMPLES, x, CHECK_ORDER, coeffs, y);
+    double sum = 0;
+    for (int n = 0; n < CHECK_SAMPLES; n++) {
+      sum += y[n] * y[n];
+    }
+    verdict("generic kernels vs convolve", relative(want[CHECK_BAND], sum / CHECK_SAMPLES), 1e-10);
+    free(x);
+  }
+
+  // the tone band must be the strongest, and over threshold
+  int peak = 0;
+  for (int b = 0; b < CHECK_BANDS; b++) {
+    peak = want[b] > want[peak] ? b : peak;
+  }
+  verdict("reference peaks at the tone band", abs(peak - CHECK_BAND), 0);
+  verdict("reference tone band over threshold",
+          want[CHECK_BAND] <= THRESHOLD * average(want, CHECK_BANDS), 0);
+
+  char* isas[] = {"generic", "sse4.2", "avx2", "avx512"};
+  for (int v = 0; v < 4; v++) {
+    char what[64];
+    sprintf(what, "scan_bands, %s kernels", isas[v]);
+    if (filter_use_isa(isas[v]) < 0) {
+      printf("%-44s skipped (not supported here)\n", what);
+      continue;
+    }
+    scan_all(sig, dc, CHECK_ORDER, bandwidth, got);
+    verdict(what, band_error(got, want, CHECK_BANDS), 1e-9);
+  }
+
+  scan_use_engine(SCAN_FFT);
+  scan_all(sig, dc, CHECK_ORDER, bandwidth, got);
+  verdict("scan_bands, FFT engine", band_error(got, want, CHECK_BANDS), 1e-9);
+  scan_use_engine(SCAN_DIRECT);
+
+  // designs: the same filters as design_band_pass, and sharp enough to
+  // pass the tone's whole power
+  filter_spec designs[] = {{DESIGN_KAISER, 60, 0}, {DESIGN_EQUIRIPPLE, 60, 0}};
+  char* names[] = {"kaiser", "remez"};
+  for (int d = 0; d < 2; d++) {
+    char what[64];
+    designs[d].transition = bandwidth;
+    int order = design_min_order(&designs[d], CHECK_FS, BAND_LOW(CHECK_BAND, bandwidth),
+                                 BAND_HIGH(CHECK_BAND, bandwidth));
+    sprintf(what, "design_min_order, %s:60", names[d]);
+    verdict(what, order < 0, 0);
+    if (order < 0) {
+      continue;
+    }
+    reference_powers(sig, dc, &designs[d], order, bandwidth, extra);
+    scan_use_design(&designs[d]);
+    scan_all(sig, dc, order, bandwidth, got);
+    scan_use_design(&hamming);
+    sprintf(what, "scan_bands, %s order %d", names[d], order);
+    verdict(what, band_error(got, extra, CHECK_BANDS), 1e-9);
+    sprintf(what, "%s tone band vs the tone's power", names[d]);
+    verdict(what, relative(got[CHECK_BAND], 0.5), 0.05);
+  }
+
+  // pre-screen: guaranteed bounds that only allow for rounding, so they
+  // must contain the reference and be narrow
+  {
+    double upper[CHECK_BANDS];
+    if (scan_prescreen(sig, dc, CHECK_ORDER, bandwidth, CHECK_BANDS, extra, upper,
+                       CHECK_THREADS, 0, 1) < 0) {
+      verdict("scan_prescreen", 1, 0);
+    } else {
+      double worst = 0;
+      double widest = 0;
+      for (int b = 0; b < CHECK_BANDS; b++) {
+        double out = fmax(extra[b] - want[b], want[b] - upper[b]) / want[b];
+        double width = (upper[b] - extra[b]) / want[b];
+        worst = out > worst ? out : worst;
+        widest = width > widest ? width : widest;
+      }
+      verdict("scan_prescreen bounds contain the reference", worst, 1e-9);
+      verdict("scan_prescreen bounds, width / reference", widest, 1e-4);
+    }
+  }
+
+  // sampled estimates: inside their intervals (deterministic seeds, so
+  // this is repeatable), and exact at stride 1
+  {
+    int bands[CHECK_BANDS];
+    double error[CHECK_BANDS];
+    for (int b = 0; b < CHECK_BANDS; b++) {
+      bands[b] = b;
+    }
+    scan_estimate(sig, dc, CHECK_ORDER, bandwidth, 1, got, error, bands, CHECK_BANDS,
+                  CHECK_THREADS, 0, 1);
+    verdict("scan_estimate, stride 1", band_error(got, want, CHECK_BANDS), 1e-9);
+    scan_estimate(sig, dc, CHECK_ORDER, bandwidth, 8, got, error, bands, CHECK_BANDS,
+                  CHECK_THREADS, 0, 1);
+    double worst = 0;
+    for (int b = 0; b < CHECK_BANDS; b++) {
+      double out = fabs(got[b] - want[b]) / error[b];
+      worst = out > worst ? out : worst;
+    }
+    verdict("scan_estimate, stride 8, error / interval", worst, 1.0);
+  }
+
+  // approximate engines, against a sharp bank: a 64 tap Hamming band
+  // pass is wider than the band and passes only about a quarter of the
+  // tone's power.  Checked on the tone band and the average the
+  // threshold uses
+  double sharp[CHECK_BANDS];
+  reference_powers(sig, dc, &hamming, SHARP_ORDER, bandwidth, sharp);
+  if (scan_welch(sig, dc, CHECK_BANDS, bandwidth, got, CHECK_THREADS, 0, 1) < 0) {
+    verdict("scan_welch", 1, 0);
+  } else {
+    verdict("scan_welch, tone band", relative(got[CHECK_BAND], sharp[CHECK_BAND]), 0.05);
+    verdict("scan_welch, band average",
+            relative(average(got, CHECK_BANDS), average(sharp, CHECK_BANDS)), 0.05);
+  }
+
+  scan_use_engine(SCAN_IIR);
+  scan_all(sig, dc, CHECK_ORDER, bandwidth, got);
+  scan_use_engine(SCAN_DIRECT);
+  verdict("IIR engine, tone band", relative(got[CHECK_BAND], sharp[CHECK_BAND]), 0.05);
+  // (the biquads leak the tone into its neighbours, see iir_bank_power)
+  verdict("IIR engine, band average",
+          relative(average(got, CHECK_BANDS), average(sharp, CHECK_BANDS)), 0.25);
+
+  {
+    int window[CHECK_BANDS];
+    int num_window = 0;
+    for (int b = 0; b < CHECK_BANDS; b++) {
+      if (in_alien_window(BAND_LOW(b, bandwidth), BAND_HIGH(b, bandwidth))) {
+        window[num_window++] = b;
+      }
+    }
+    double low = BAND_LOW(window[0], bandwidth);
+    double high = BAND_HIGH(window[num_window - 1], bandwidth);
+    int stages = frontend_stages(CHECK_FS, high - low);
+    memcpy(got, want, sizeof(got));
+    scan_baseband(sig, dc, (low + high) / 2, stages, CHECK_ORDER, bandwidth,
+                  got, window, num_window, CHECK_THREADS, 0, 1);
+    verdict("scan_baseband, tone band", relative(got[CHECK_BAND], want[CHECK_BAND]), 0.05);
+  }
+
+  // tone detectors against the tone's known power, A^2 / 2
+  {
+    double power;
+    scan_tones(sig, dc, 1, &tone_hz, &power, CHECK_THREADS, 0, 1);
+    verdict("scan_tones (Goertzel), tone power", relative(power, 0.5), 0.01);
+    double omega = 2 * M_PI * tone_hz / CHECK_FS;
+    sliding_dft* s = sliding_dft_create(CHECK_SAMPLES / 4, dc, 1, &omega);
+    sliding_dft_push(s, CHECK_SAMPLES, sig->data);
+    double slid;
+    sliding_dft_power(s, &slid);
+    double re = 0, im = 0;
+    goertzel_bank(CHECK_SAMPLES / 4, sig->data + CHECK_SAMPLES - CHECK_SAMPLES / 4, dc,
+                  CHECK_SAMPLES - CHECK_SAMPLES / 4, 1, &omega, &re, &im);
+    verdict("sliding DFT vs Goertzel, last window",
+            relative(slid, goertzel_power(CHECK_SAMPLES / 4, omega, re, im)), 1e-9);
+    sliding_dft_free(s);
+  }
+
+  // I/Q, both engines
+  {
+    signal* iq = make_iq_signal(tone_hz);
+    signal_to_iq(iq);
+    signal_stats i_stats, q_stats;
+    iq_signal_statistics(iq->data, iq->num_samples, &i_stats, &q_stats);
+    double iq_bandwidth = CHECK_FS / CHECK_BANDS;
+    report_band_origin(-CHECK_FS / 2);
+    reference_iq_powers(iq, i_stats.mean, q_stats.mean, CHECK_ORDER, iq_bandwidth, extra);
+    int bands[CHECK_BANDS];
+    for (int b = 0; b < CHECK_BANDS; b++) {
+      bands[b] = b;
+    }
+    scan_bands_iq(iq, i_stats.mean, q_stats.mean, CHECK_ORDER, iq_bandwidth, got,
+                  bands, CHECK_BANDS, CHECK_THREADS, 0, 1);
+    verdict("scan_bands_iq, direct", band_error(got, extra, CHECK_BANDS), 1e-9);
+    scan_use_engine(SCAN_FFT);
+    scan_bands_iq(iq, i_stats.mean, q_stats.mean, CHECK_ORDER, iq_bandwidth, got,
+                  bands, CHECK_BANDS, CHECK_THREADS, 0, 1);
+    scan_use_engine(SCAN_DIRECT);
+    verdict("scan_bands_iq, FFT engine", band_error(got, extra, CHECK_BANDS), 1e-9);
+    report_band_origin(0);
+
+    if (save_binary_format_signal("check_iq.bin", iq)) {
+      verdict("writing check_iq.bin", 1, 0);
+    }
+    free_signal(iq);
+  }
+
+  fft_cleanup();
+
+  // for the detection paths: the tone in the window, and only outside it
+  signal* quiet = make_signal(tone_hz, 0.0);
+  if (save_binary_format_signal("check_alien.bin", sig) ||
+      save_binary_format_signal("check_quiet.bin", quiet)) {
+    verdict("writing check signals", 1, 0);
+  }
+  free_signal(quiet);
+  free_signal(sig);
+
+  printf("%d check%s failed\n", failures, failures == 1 ? "" : "s");
+  return failures ? 1 : 0;
+}
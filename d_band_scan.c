@@ -0,0 +1,507 @@
+#define _GNU_SOURCE
+#include <unistd.h>   // unix standard apis
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netdb.h>
+#include <poll.h>
+#include <errno.h>
+#include <limits.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <assert.h>
+
+#include "filter.h"
+#include "signal.h"
+#include "timing.h"
+#include "report.h"
+#include "scan.h"
+
+/*
+ * Distributed band scan.
+ *
+ * A coordinator splits the bands into contiguous ranges, one per worker
+ * process, and hands each worker a job over a TCP or Unix socket.  Every
+ * worker maps the same capture file (copy-on-write, though the filters
+ * subtract the DC on the fly and never write to it), filters its bands
+ * with its own pinned threads and sends the band powers back.  The
+ * coordinator then prints the usual report.  Workers can run on any node
+ * that sees the capture file at the same path; "local" mode forks the
+ * workers on this machine, which is how the whole thing is tested.
+ */
+
+// <sys/wait.h> drags in <signal.h>, whose signal() clashes with our
+// signal type, so declare the one call we need ourselves (<stdlib.h> has
+// the WNOHANG and status macros)
+extern pid_t waitpid(pid_t pid, int* status, int options);
+
+#define DSCAN_MAGIC       0x5e71da7a
+#define CONNECT_RETRY_SEC 30   // how long a worker waits for its coordinator
+#define ACCEPT_TIMEOUT_SEC (2 * CONNECT_RETRY_SEC) // and the coordinator for a worker
+#define ACCEPT_POLL_MSEC  100  // how often it looks at its local workers meanwhile
+
+typedef struct job {
+  int magic;
+  char sig_type;          // T, B or M as on the command line
+  char file[PATH_MAX];    // absolute path of the capture
+  double Fs;
+  double dc;              // DC component the coordinator measured
+  int filter_order;
+  int num_bands;
+  int first_band;         // this worker scans first_band..first_band+num_scan-1
+  int num_scan;
+} job;
+
+typedef struct result_header {
+  int magic;
+  int first_band;
+  int num_scan;
+  double seconds;         // time the worker spent filtering
+} result_header;          // followed by num_scan doubles of band power
+
+void usage() {
+  printf("usage: d_band_scan serve address num_workers text|bin|mmap signal_file Fs filter_order num_bands\n"
+         "       d_band_scan work address num_threads num_processors [first_processor]\n"
+         "       d_band_scan local num_workers num_threads text|bin|mmap signal_file Fs filter_order num_bands\n"
+         "  address is unix:/path/to/socket or host:port\n");
+}
+
+double avg_of(double* data, int num) {
+
+  double s = 0;
+  for (int i = 0; i < num; i++) {
+    s += data[i];
+  }
+  return s / num;
+}
+
+int send_all(int fd, void* buf, long len) {
+  char* cur = (char*)buf;
+  while (len > 0) {
+    long n = send(fd, cur, len, MSG_NOSIGNAL);
+    if (n <= 0) {
+      perror("Send failure");
+      return -1;
+    }
+    cur += n;
+    len -= n;
+  }
+  return 0;
+}
+
+int recv_all(int fd, void* buf, long len) {
+  char* cur = (char*)buf;
+  while (len > 0) {
+    long n = recv(fd, cur, len, 0);
+    if (n <= 0) {
+      if (n < 0) {
+        perror("Receive failure");
+      } else {
+        fprintf(stderr, "Connection closed early\n");
+      }
+      return -1;
+    }
+    cur += n;
+    len -= n;
+  }
+  return 0;
+}
+
+// Resolve "unix:/path" or "host:port".  For listening, an empty host
+// means any interface.
+int make_socket(char* address, int listening) {
+
+  if (!strncmp(address, "unix:", 5)) {
+    struct sockaddr_un sun;
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    if (strlen(address + 5) >= sizeof(sun.sun_path)) {
+      fprintf(stderr, "Socket path too long: %s\n", address + 5);
+      return -1;
+    }
+    strcpy(sun.sun_path, address + 5);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+      perror("Cannot create socket");
+      return -1;
+    }
+    if (listening) {
+      unlink(sun.sun_path);
+      if (bind(fd, (struct sockaddr*)&sun, sizeof(sun)) < 0 || listen(fd, SOMAXCONN) < 0) {
+        perror("Cannot listen");
+        close(fd);
+        return -1;
+      }
+    } else if (connect(fd, (struct sockaddr*)&sun, sizeof(sun)) < 0) {
+      close(fd);
+      return -1;
+    }
+    return fd;
+  }
+
+  char host[256];
+  char* colon = strrchr(address, ':');
+  if (!colon || colon - address >= (long)sizeof(host)) {
+    fprintf(stderr, "Bad address %s\n", address);
+    return -1;
+  }
+  memcpy(host, address, colon - address);
+  host[colon - address] = 0;
+
+  struct addrinfo hints, *res;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family   = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags    = listening ? AI_PASSIVE : 0;
+  int rc = getaddrinfo(host[0] ? host : 0, colon + 1, &hints, &res);
+  if (rc) {
+    fprintf(stderr, "Cannot resolve %s: %s\n", address, gai_strerror(rc));
+    return -1;
+  }
+
+  int fd = -1;
+  for (struct addrinfo* ai = res; ai; ai = ai->ai_next) {
+    fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (fd < 0) {
+      continue;
+    }
+    if (listening) {
+      int one = 1;
+      setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+      if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 && listen(fd, SOMAXCONN) == 0) {
+        break;
+      }
+    } else if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+      break;
+    }
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(res);
+
+  if (fd < 0 && listening) {
+    perror("Cannot listen");
+  }
+  return fd;
+}
+
+signal* open_signal(char sig_type, char* sig_file) {
+  switch (sig_type) {
+    case 'T':
+      return load_text_format_signal(sig_file);
+    case 'B':
+      return load_binary_format_signal(sig_file);
+    case 'M':
+      return map_private_binary_format_signal(sig_file);
+    default:
+      printf("Unknown signal type\n");
+      return 0;
+  }
+}
+
+// Worker side: take one job, scan its bands, send back the powers
+int work(char* address, int num_threads, int first_processor, int num_processors) {
+
+  int fd = -1;
+  double start = get_seconds();
+  while ((fd = make_socket(address, 0)) < 0) {
+    if (get_seconds_diff(start) > CONNECT_RETRY_SEC) {
+      fprintf(stderr, "Cannot reach coordinator at %s\n", address);
+      return -1;
+    }
+    usleep(100000);
+  }
+
+  job j;
+  if (recv_all(fd, &j, sizeof(j)) || j.magic != DSCAN_MAGIC) {
+    fprintf(stderr, "Bad job from coordinator\n");
+    close(fd);
+    return -1;
+  }
+
+  signal* sig = open_signal(j.sig_type, j.file);
+  if (!sig) {
+    close(fd);
+    return -1;
+  }
+  sig->Fs = j.Fs;
+
+  double bandwidth  = (sig->Fs / 2) / j.num_bands;
+  double* band_power = malloc(j.num_bands * sizeof(double));
+  int* bands = malloc(j.num_scan * sizeof(int));
+  for (int k = 0; k < j.num_scan; k++) {
+    bands[k] = j.first_band + k;
+  }
+
+  double scan_start = get_seconds();
+  scan_bands(sig, j.dc, j.filter_order, bandwidth, band_power, bands, j.num_scan,
+             num_threads, first_processor, num_processors);
+
+  result_header h = {DSCAN_MAGIC, j.first_band, j.num_scan, get_seconds_diff(scan_start)};
+  int rc = send_all(fd, &h, sizeof(h)) ||
+           send_all(fd, band_power + j.first_band, j.num_scan * sizeof(double));
+
+  close(fd);
+  free(bands);
+  free(band_power);
+  free_signal(sig);
+
+  return rc ? -1 : 0;
+}
+
+// Next worker connection, or -1 if none comes within ACCEPT_TIMEOUT_SEC
+// or one of the num_children local worker processes (children[], 0 once
+// reaped) dies first: a worker only exits cleanly after reporting, so a
+// failed exit means it will never connect
+int accept_worker(int listen_fd, pid_t* children, int num_children) {
+
+  double start = get_seconds();
+  for (;;) {
+    struct pollfd p = {listen_fd, POLLIN, 0};
+    int rc = poll(&p, 1, ACCEPT_POLL_MSEC);
+    if (rc > 0) {
+      int fd = accept(listen_fd, 0, 0);
+      if (fd < 0) {
+        perror("Cannot accept worker");
+      }
+      return fd;
+    }
+    if (rc < 0 && errno != EINTR) {
+      perror("Cannot wait for workers");
+      return -1;
+    }
+
+    for (int w = 0; w < num_children; w++) {
+      int status;
+      if (children[w] > 0 && waitpid(children[w], &status, WNOHANG) == children[w]) {
+        children[w] = 0;
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+          fprintf(stderr, "Worker process %d failed before connecting\n", w);
+          return -1;
+        }
+      }
+    }
+
+    if (get_seconds_diff(start) > ACCEPT_TIMEOUT_SEC) {
+      fprintf(stderr, "No worker connected within %d seconds\n", ACCEPT_TIMEOUT_SEC);
+      return -1;
+    }
+  }
+}
+
+// Error exit of coordinate: hang up on workers first .. last - 1
+int abandon(int* conns, int first, int last, double* band_power) {
+  for (int w = first; w < last; w++) {
+    close(conns[w]);
+  }
+  free(conns);
+  free(band_power);
+  return -1;
+}
+
+// Coordinator side: hand out band ranges, gather powers, report.
+// children are the local worker processes, if any (see accept_worker).
+int coordinate(int listen_fd, int num_workers, pid_t* children, int num_children,
+               char sig_type, char* sig_file,
+               double Fs, int filter_order, int num_bands, double* lb, double* ub) {
+
+  signal* sig = open_signal(sig_type, sig_file);
+  if (!sig) {
+    printf("Unable to load or map file\n");
+    return -1;
+  }
+  sig->Fs = Fs;
+
+  signal_stats stats;
+  signal_statistics(sig->data, sig->num_samples, &stats);
+  double dc = stats.mean;
+  printf("Removing DC component of %lf\n", dc);
+  printf("signal average power:     %lf\n", stats.power);
+  free_signal(sig);
+
+  double bandwidth = (Fs / 2) / num_bands;
+  double* band_power = malloc(num_bands * sizeof(double));
+  int* conns = malloc(num_workers * sizeof(int));
+
+  resources rstart;
+  get_resources(&rstart,THIS_PROCESS);
+  double time_start = get_seconds();
+
+  job j;
+  memset(&j, 0, sizeof(j));
+  j.magic = DSCAN_MAGIC;
+  j.sig_type = sig_type;
+  if (!realpath(sig_file, j.file)) {
+    perror("Cannot resolve signal file");
+    return abandon(conns, 0, 0, band_power);
+  }
+  j.Fs = Fs;
+  j.dc = dc;
+  j.filter_order = filter_order;
+  j.num_bands = num_bands;
+
+  for (int w = 0; w < num_workers; w++) {
+    if ((conns[w] = accept_worker(listen_fd, children, num_children)) < 0) {
+      return abandon(conns, 0, w, band_power);
+    }
+    j.first_band = (long)w * num_bands / num_workers;
+    j.num_scan   = (long)(w + 1) * num_bands / num_workers - j.first_band;
+    if (send_all(conns[w], &j, sizeof(j))) {
+      fprintf(stderr, "Cannot send job to worker %d\n", w);
+      return abandon(conns, 0, w + 1, band_power);
+    }
+  }
+
+  for (int w = 0; w < num_workers; w++) {
+    result_header h;
+    if (recv_all(conns[w], &h, sizeof(h)) || h.magic != DSCAN_MAGIC ||
+        h.first_band < 0 || h.num_scan < 0 || h.first_band + h.num_scan > num_bands ||
+        recv_all(conns[w], band_power + h.first_band, h.num_scan * sizeof(double))) {
+      fprintf(stderr, "Bad result from worker %d\n", w);
+      return abandon(conns, w, num_workers, band_power);
+    }
+    printf("worker %d: bands %d to %d in %lf seconds\n",
+           w, h.first_band, h.first_band + h.num_scan - 1, h.seconds);
+    close(conns[w]);
+  }
+
+  double time_end = get_seconds();
+
+  resources rend;
+  get_resources(&rend,THIS_PROCESS);
+
+  resources rdiff;
+  get_resources_diff(&rstart, &rend, &rdiff);
+
+  int wow = report_bands(num_bands, bandwidth, band_power,
+                         avg_of(band_power, num_bands), lb, ub);
+
+  report_resources(&rdiff);
+  printf("Analysis took %lf seconds by basic timing\n", time_end - time_start);
+
+  free(conns);
+  free(band_power);
+
+  return wow;
+}
+
+int main(int argc, char* argv[]) {
+
+  if (argc < 2) {
+    usage();
+    return -1;
+  }
+
+  if (!strcmp(argv[1], "work")) {
+    if (argc != 5 && argc != 6) {
+      usage();
+      return -1;
+    }
+    int num_threads     = atoi(argv[3]);
+    int num_processors  = atoi(argv[4]);
+    int first_processor = argc == 6 ? atoi(argv[5]) : 0;
+    assert(num_threads > 0 && num_processors > 0);
+    return work(argv[2], num_threads, first_processor, num_processors) ? -1 : 0;
+  }
+
+  int local = !strcmp(argv[1], "local");
+  if ((!local && strcmp(argv[1], "serve")) || argc != 9) {
+    usage();
+    return -1;
+  }
+
+  char address[128];
+  int num_workers  = atoi(argv[local ? 2 : 3]);
+  int num_threads  = local ? atoi(argv[3]) : 0;
+  char sig_type    = toupper(argv[4][0]);
+  char* sig_file   = argv[5];
+  double Fs        = atof(argv[6]);
+  int filter_order = atoi(argv[7]);
+  int num_bands    = atoi(argv[8]);
+
+  if (local) {
+    snprintf(address, sizeof(address), "unix:/tmp/d_band_scan.%d", (int)getpid());
+  } else {
+    snprintf(address, sizeof(address), "%s", argv[2]);
+  }
+
+  assert(num_workers > 0 && num_workers <= num_bands);
+  assert(Fs > 0.0);
+  assert(filter_order > 0 && !(filter_order & 0x1));
+  assert(num_bands > 0);
+
+  printf("type:     %s\n\
+file:     %s\n\
+Fs:       %lf Hz\n\
+order:    %d\n\
+bands:    %d\n\
+workers:  %d at %s\n",
+         sig_type == 'T' ? "Text" : (sig_type == 'B' ? "Binary" : (sig_type == 'M' ? "Mapped Binary" : "UNKNOWN TYPE")),
+         sig_file,
+         Fs,
+         filter_order,
+         num_bands,
+         num_workers,
+         address);
+
+  int listen_fd = make_socket(address, 1);
+  if (listen_fd < 0) {
+    return -1;
+  }
+
+  pid_t* children = calloc(num_workers, sizeof(pid_t));
+  int num_children = 0;
+  if (local) {
+    // one worker process per slice of the processors
+    int num_processors = sysconf(_SC_NPROCESSORS_ONLN);
+    fflush(stdout);
+    for (int w = 0; w < num_workers; w++) {
+      pid_t pid = fork();
+      if (pid < 0) {
+        perror("Cannot fork worker");
+        return -1;
+      }
+      children[num_children++] = pid;
+      if (pid == 0) {
+        close(listen_fd);
+        fclose(stdout); // keep the report clean
+        _exit(work(address, num_threads, w * num_threads, num_processors) ? 1 : 0);
+      }
+    }
+  }
+
+  double start = 0;
+  double end   = 0;
+  int wow = coordinate(listen_fd, num_workers, children, num_children, sig_type, sig_file,
+                       Fs, filter_order, num_bands, &start, &end);
+
+  close(listen_fd);
+  if (!strncmp(address, "unix:", 5)) {
+    unlink(address + 5);
+  }
+
+  // after a failure, workers still waiting to connect give up on their
+  // own (the socket is gone) and are not waited for
+  for (int w = 0; w < num_children && wow >= 0; w++) {
+    if (children[w] > 0) {
+      waitpid(children[w], 0, 0);
+    }
+  }
+  free(children);
+
+  if (wow < 0) {
+    return -1;
+  }
+
+  if (wow) {
+    printf("POSSIBLE ALIENS %lf-%lf HZ (CENTER %lf HZ)\n", start, end, (end + start) / 2.0);
+  } else {
+    printf("no aliens\n");
+  }
+
+  return 0;
+}
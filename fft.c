@@ -0,0 +1,607 @@
+#define _GNU_SOURCE
+#include <sched.h>    // for processor affinity
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "fft.h"
+#include "filter.h"
+
+/*
+ * Plan cache.  A short list is plenty: a run uses one or two block sizes.
+ * The FFTW planner is not thread safe, so making plans is serialized;
+ * executing them needs no lock.
+ */
+
+typedef struct cached_plan {
+  struct cached_plan* next;
+  int n;
+  int howmany;          // transforms per execution, back to back
+  int nthreads;         // FFTW threads per execution
+  fft_direction dir;
+  int in_align;         // fftw_alignment_of the arrays planned for
+  int out_align;
+  fftw_plan plan;
+} cached_plan;
+
+static pthread_mutex_t plan_lock = PTHREAD_MUTEX_INITIALIZER;
+static cached_plan* plans = 0;
+static unsigned planner_flags = FFTW_MEASURE;
+static long plans_made = 0;
+static long plans_reused = 0;
+static int threads_ready = 0;  // fftw_init_threads done
+static int fft_threads = 1;    // threads new transforms may use
+
+void fft_set_planner(unsigned flags) {
+  planner_flags = flags;
+}
+
+int fft_import_wisdom(char* path) {
+  pthread_mutex_lock(&plan_lock);
+  int ok = fftw_import_wisdom_from_filename(path);
+  pthread_mutex_unlock(&plan_lock);
+  return ok ? 0 : -1;
+}
+
+int fft_export_wisdom(char* path) {
+  pthread_mutex_lock(&plan_lock);
+  int ok = fftw_export_wisdom_to_filename(path);
+  pthread_mutex_unlock(&plan_lock);
+  return ok ? 0 : -1;
+}
+
+fftw_plan fft_plan(int n, fft_direction dir, void* in, void* out) {
+  return fft_plan_many(n, 1, 1, dir, in, out);
+}
+
+fftw_plan fft_plan_many(int n, int howmany, int nthreads,
+                        fft_direction dir, void* in, void* out) {
+
+  int in_align  = fftw_alignment_of((double*)in);
+  int out_align = fftw_alignment_of((double*)out);
+
+  pthread_mutex_lock(&plan_lock);
+
+  for (cached_plan* c = plans; c; c = c->next) {
+    if (c->n == n && c->howmany == howmany && c->nthreads == nthreads &&
+        c->dir == dir && c->in_align == in_align && c->out_align == out_align) {
+      plans_reused++;
+      pthread_mutex_unlock(&plan_lock);
+      return c->plan;
+    }
+  }
+
+  // Measuring scribbles over the arrays, so plan on scratch arrays with
+  // the same alignment rather than the caller's data
+  long bins = n / 2 + 1;
+  long bytes = sizeof(fftw_complex) * bins * howmany + 16;
+  char* a = fftw_malloc(bytes);
+  char* b = fftw_malloc(bytes);
+  cached_plan* c = malloc(sizeof(cached_plan));
+  if (!a || !b || !c) {
+    perror("Not enough memory");
+    exit(-1);
+  }
+
+  c->n = n;
+  c->howmany = howmany;
+  c->nthreads = nthreads;
+  c->dir = dir;
+  c->in_align = in_align;
+  c->out_align = out_align;
+
+  // the planner's thread count is global state, hence under the lock
+  if (threads_ready) {
+    fftw_plan_with_nthreads(nthreads);
+  }
+  // transforms are n reals / n / 2 + 1 complex bins apart
+  if (dir == FFT_R2C) {
+    c->plan = fftw_plan_many_dft_r2c(1, &n, howmany,
+                                     (double*)(a + in_align), 0, 1, n,
+                                     (fftw_complex*)(b + out_align), 0, 1, bins,
+                                     planner_flags);
+  } else {
+    c->plan = fftw_plan_many_dft_c2r(1, &n, howmany,
+                                     (fftw_complex*)(a + in_align), 0, 1, bins,
+                                     (double*)(b + out_align), 0, 1, n,
+                                     planner_flags);
+  }
+  if (threads_ready) {
+    fftw_plan_with_nthreads(1);
+  }
+  fftw_free(a);
+  fftw_free(b);
+
+  if (!c->plan) {
+    fprintf(stderr, "Cannot make a size %d x %d FFT plan\n", n, howmany);
+    exit(-1);
+  }
+
+  c->next = plans;
+  plans = c;
+  plans_made++;
+
+  pthread_mutex_unlock(&plan_lock);
+  return c->plan;
+}
+
+
+/*
+ * FFTW's own threads.  Instead of letting FFTW start threads wherever
+ * the scheduler likes, its parallel loops are handed to a callback that
+ * runs the pieces on threads pinned next to the thread executing the
+ * plan, the same way the scan pins its workers, so scan workers and FFTW
+ * threads never pile onto the same processors.
+ *
+ * FFTW calls back for every parallel loop of every transform, far too
+ * often to start threads each time, so the pieces go to a pool of
+ * persistent helpers, one pinned to each processor (and unpinned ones for
+ * callers that were never pinned), started by fft_pin_threads for the
+ * processors its thread's transforms will use (others on demand) and
+ * stopped by fft_cleanup.  A helper
+ * takes one piece at a time; the callers in a scan are pinned to disjoint
+ * processors, so they never wait for each other's helpers.
+ */
+
+static __thread int pin_first = -1;  // where this thread's FFTW helpers go
+static __thread int pin_num   = 0;
+static __thread int is_helper = 0;   // this thread is one of the pool's
+
+// A parallel loop in progress: how many of its pieces are still running
+typedef struct fft_loop {
+  pthread_mutex_t lock;
+  pthread_cond_t done;
+  int left;
+} fft_loop;
+
+typedef struct fft_helper {
+  pthread_t tid;
+  int processor;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;    // a piece was posted, taken, or quit was set
+  void* (*work)(char*);   // the posted piece, 0 if idle
+  char* data;
+  fft_loop* loop;
+  int quit;
+} fft_helper;
+
+// pool[p] is pinned to processor p; callers that were never pinned use
+// free_pool[k] for their k-th piece, unpinned like them
+typedef struct fft_pool {
+  fft_helper** helpers;
+  int size;
+} fft_pool;
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static fft_pool pool = {0, 0};
+static fft_pool free_pool = {0, 0};
+
+static void pin(int processor) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(processor, &set);
+  if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+    perror("Can't setaffinity");
+    exit(-1);
+  }
+}
+
+static void* helper_main(void* arg) {
+  fft_helper* h = (fft_helper*)arg;
+
+  if (h->processor >= 0) {
+    pin(h->processor);
+  }
+  is_helper = 1;
+
+  pthread_mutex_lock(&h->lock);
+  for (;;) {
+    while (!h->work && !h->quit) {
+      pthread_cond_wait(&h->cond, &h->lock);
+    }
+    if (!h->work) {
+      break;
+    }
+    void* (*work)(char*) = h->work;
+    char* data = h->data;
+    fft_loop* loop = h->loop;
+    pthread_mutex_unlock(&h->lock);
+
+    work(data);
+
+    pthread_mutex_lock(&loop->lock);
+    if (--loop->left == 0) {
+      pthread_cond_signal(&loop->done);
+    }
+    pthread_mutex_unlock(&loop->lock);
+
+    pthread_mutex_lock(&h->lock);
+    h->work = 0;
+    pthread_cond_broadcast(&h->cond);
+  }
+  pthread_mutex_unlock(&h->lock);
+
+  return 0;
+}
+
+// Helper i of a pool, started if need be, pinned to processor i unless
+// it is in free_pool
+static fft_helper* get_helper(fft_pool* from, int i) {
+
+  pthread_mutex_lock(&pool_lock);
+  if (i >= from->size) {
+    fft_helper** grown = realloc(from->helpers, (i + 1) * sizeof(fft_helper*));
+    if (!grown) {
+      perror("Not enough memory");
+      exit(-1);
+    }
+    from->helpers = grown;
+    for (int q = from->size; q <= i; q++) {
+      from->helpers[q] = 0;
+    }
+    from->size = i + 1;
+  }
+  if (!from->helpers[i]) {
+    fft_helper* h = malloc(sizeof(fft_helper));
+    if (!h) {
+      perror("Not enough memory");
+      exit(-1);
+    }
+    h->processor = from == &free_pool ? -1 : i;
+    pthread_mutex_init(&h->lock, NULL);
+    pthread_cond_init(&h->cond, NULL);
+    h->work = 0;
+    h->quit = 0;
+    if (pthread_create(&h->tid, NULL, helper_main, h) != 0) {
+      perror("Failed to start thread");
+      exit(-1);
+    }
+    from->helpers[i] = h;
+  }
+  fft_helper* h = from->helpers[i];
+  pthread_mutex_unlock(&pool_lock);
+  return h;
+}
+
+static void stop_pool(fft_pool* from) {
+  for (int i = 0; i < from->size; i++) {
+    fft_helper* h = from->helpers[i];
+    if (!h) {
+      continue;
+    }
+    pthread_mutex_lock(&h->lock);
+    h->quit = 1;
+    pthread_cond_broadcast(&h->cond);
+    pthread_mutex_unlock(&h->lock);
+    pthread_join(h->tid, NULL);
+    pthread_mutex_destroy(&h->lock);
+    pthread_cond_destroy(&h->cond);
+    free(h);
+  }
+  free(from->helpers);
+  from->helpers = 0;
+  from->size = 0;
+}
+
+static void pinned_threads(void* (*work)(char*), char* jobdata, size_t elsize,
+                           int njobs, void* data) {
+
+  // a helper's own transforms (if FFTW ever nests) run serially, so it
+  // never waits on itself
+  if (is_helper) {
+    for (int k = 0; k < njobs; k++) {
+      work(jobdata + k * elsize);
+    }
+    return;
+  }
+
+  fft_loop loop;
+  pthread_mutex_init(&loop.lock, NULL);
+  pthread_cond_init(&loop.done, NULL);
+  loop.left = njobs - 1;
+
+  // piece 0 runs right here, on the processor the caller was given;
+  // piece k on the helper of the k-th processor after it
+  for (int k = 1; k < njobs; k++) {
+    fft_helper* h = pin_first >= 0 ? get_helper(&pool, (pin_first + k) % pin_num) :
+                                     get_helper(&free_pool, k);
+    pthread_mutex_lock(&h->lock);
+    while (h->work) {
+      pthread_cond_wait(&h->cond, &h->lock);
+    }
+    h->work = work;
+    h->data = jobdata + k * elsize;
+    h->loop = &loop;
+    pthread_cond_broadcast(&h->cond);
+    pthread_mutex_unlock(&h->lock);
+  }
+
+  work(jobdata);
+
+  pthread_mutex_lock(&loop.lock);
+  while (loop.left > 0) {
+    pthread_cond_wait(&loop.done, &loop.lock);
+  }
+  pthread_mutex_unlock(&loop.lock);
+  pthread_mutex_destroy(&loop.lock);
+  pthread_cond_destroy(&loop.done);
+}
+
+void fft_cleanup() {
+
+  pthread_mutex_lock(&pool_lock);
+  stop_pool(&pool);
+  stop_pool(&free_pool);
+  pthread_mutex_unlock(&pool_lock);
+
+  fft_forget_plans();
+
+  pthread_mutex_lock(&plan_lock);
+  if (threads_ready) {
+    fftw_cleanup_threads();
+    threads_ready = 0;
+  }
+  fft_threads = 1;
+  pthread_mutex_unlock(&plan_lock);
+}
+
+void fft_set_threads(int nthreads) {
+
+  pthread_mutex_lock(&plan_lock);
+  if (nthreads > 1 && !threads_ready) {
+    if (!fftw_init_threads()) {
+      fprintf(stderr, "FFTW threads not available, using 1\n");
+      nthreads = 1;
+    } else {
+      fftw_threads_set_callback(pinned_threads, 0);
+      threads_ready = 1;
+    }
+  }
+  fft_threads = nthreads > 1 ? nthreads : 1;
+  pthread_mutex_unlock(&plan_lock);
+}
+
+void fft_pin_threads(int first_processor, int num_processors) {
+  pin_first = first_processor;
+  pin_num   = num_processors;
+
+  // this thread's helpers up front, so no transform pays to start one
+  pthread_mutex_lock(&plan_lock);
+  int nthreads = fft_threads;
+  pthread_mutex_unlock(&plan_lock);
+  for (int k = 1; k < nthreads; k++) {
+    get_helper(&pool, (first_processor + k) % num_processors);
+  }
+}
+
+void fft_plan_stats(long* made, long* reused) {
+  pthread_mutex_lock(&plan_lock);
+  *made = plans_made;
+  *reused = plans_reused;
+  pthread_mutex_unlock(&plan_lock);
+}
+
+void fft_forget_plans() {
+  pthread_mutex_lock(&plan_lock);
+  while (plans) {
+    cached_plan* next = plans->next;
+    fftw_destroy_plan(plans->plan);
+    free(plans);
+    plans = next;
+  }
+  pthread_mutex_unlock(&plan_lock);
+}
+
+int fft_block_size(int order) {
+  int M = FFT_BLOCK;
+  while (M <= 2 * order) {
+    M *= 2;
+  }
+  return M;
+}
+
+
+/*
+ * Per-thread scratch: the block being transformed, its spectrum and the
+ * filter's spectrum.  Allocated the first time a thread needs a given
+ * block size and freed when the thread exits, so filtering a band does
+ * no allocation at all.
+ */
+
+typedef struct fft_scratch {
+  int M;
+  double* block;          // FFT_BATCH blocks of M
+  fftw_complex* spec;     // FFT_BATCH spectra of M / 2 + 1
+  fftw_complex* H;        // M / 2 + 1
+} fft_scratch;
+
+static pthread_key_t scratch_key;
+static pthread_once_t scratch_once = PTHREAD_ONCE_INIT;
+
+static void free_scratch(void* p) {
+  fft_scratch* s = (fft_scratch*)p;
+  fftw_free(s->block);
+  fftw_free(s->spec);
+  fftw_free(s->H);
+  free(s);
+}
+
+static void make_scratch_key() {
+  pthread_key_create(&scratch_key, free_scratch);
+}
+
+static fft_scratch* get_scratch(int M) {
+
+  pthread_once(&scratch_once, make_scratch_key);
+
+  fft_scratch* s = pthread_getspecific(scratch_key);
+  if (s && s->M == M) {
+    return s;
+  }
+  if (s) {
+    free_scratch(s);
+  }
+
+  s = malloc(sizeof(fft_scratch));
+  if (!s) {
+    perror("Not enough memory");
+    exit(-1);
+  }
+  s->M = M;
+  s->block = fftw_alloc_real((long)M * FFT_BATCH);
+  s->spec  = fftw_alloc_complex((long)(M / 2 + 1) * FFT_BATCH);
+  s->H     = fftw_alloc_complex(M / 2 + 1);
+  if (!s->block || !s->spec || !s->H) {
+    perror("Not enough memory");
+    exit(-1);
+  }
+  pthread_setspecific(scratch_key, s);
+  return s;
+}
+
+/*
+ * Overlap-save.  Each block of M inputs x[s - order .. s + L) (zeros
+ * before the start and past the end, dc subtracted) is circularly
+ * convolved with the filter; outputs order..M-1 of the result did not
+ * wrap around and are the linear convolution outputs y[s .. s + L).
+ * Blocks go through FFTW FFT_BATCH at a time, as one many-transform plan
+ * (using fft_threads threads if more than one).  Writes the outputs to
+ * output if it is not 0, and returns the sum of their squares.
+ *
+ * With an oscillator osc, input is I/Q interleaved instead: each block is
+ * mixed down (less dc + j dc_q) straight into the transform input, its I
+ * and Q as two blocks of the batch, so the mixed signal never exists
+ * beyond the batch.  The sum is then over the outputs of both; output
+ * must be 0.
+ */
+static double overlap_save(int length, double input[], double dc,
+                           nco* osc, double dc_q,
+                           int order, double coeffs[], double output[]) {
+
+  int M = fft_block_size(order);
+  int L = M - order;
+  int bins = M / 2 + 1;
+  int nthreads = fft_threads;
+  int per = osc ? 2 : 1;            // transforms per block of input
+  fft_scratch* s = get_scratch(M);
+
+  // filter spectrum, with the 1/M the unnormalized inverse needs
+  fftw_plan fwd = fft_plan(M, FFT_R2C, s->block, s->H);
+  memset(s->block, 0, M * sizeof(double));
+  for (int j = 0; j <= order; j++) {
+    s->block[j] = coeffs[j] / M;
+  }
+  fftw_execute_dft_r2c(fwd, s->block, s->H);
+
+  double pow_sum = 0;
+  long num_blocks = (length + L - 1) / L;
+
+  for (long first = 0; first < num_blocks; first += FFT_BATCH / per) {
+
+    int blocks = num_blocks - first < FFT_BATCH / per ? num_blocks - first : FFT_BATCH / per;
+    int batch = blocks * per;
+
+    for (int b = 0; b < blocks; b++) {
+      long start = (first + b) * L;
+      if (osc) {
+        double* re = s->block + 2L * b * M;
+        double* im = re + M;
+        long lo = start - order > 0 ? start - order : 0;
+        long hi = start - order + M < length ? start - order + M : length;
+        int head = lo - (start - order);
+        int tail = M - head - (hi - lo);
+        memset(re, 0, head * sizeof(double));
+        memset(im, 0, head * sizeof(double));
+        nco_mix(osc, lo, hi - lo, input, input + 1, 2, dc, dc_q, re + head, im + head);
+        memset(re + M - tail, 0, tail * sizeof(double));
+        memset(im + M - tail, 0, tail * sizeof(double));
+        continue;
+      }
+      double* block = s->block + (long)b * M;
+      for (int k = 0; k < M; k++) {
+        long i = start - order + k;
+        block[k] = i >= 0 && i < length ? input[i] - dc : 0;
+      }
+    }
+
+    // the last, short batch gets its own (cached) plans
+    fftw_execute_dft_r2c(fft_plan_many(M, batch, nthreads, FFT_R2C, s->block, s->spec),
+                         s->block, s->spec);
+
+    for (long b = 0; b < (long)batch * bins; b++) {
+      fftw_complex* h = s->H + b % bins;
+      double re = s->spec[b][0] * (*h)[0] - s->spec[b][1] * (*h)[1];
+      double im = s->spec[b][0] * (*h)[1] + s->spec[b][1] * (*h)[0];
+      s->spec[b][0] = re;
+      s->spec[b][1] = im;
+    }
+
+    fftw_execute_dft_c2r(fft_plan_many(M, batch, nthreads, FFT_C2R, s->spec, s->block),
+                         s->spec, s->block);
+
+    for (int b = 0; b < batch; b++) {
+      long start = (first + b / per) * L;
+      int n = length - start < L ? length - start : L;
+      double* y = s->block + (long)b * M + order;
+      for (int k = 0; k < n; k++) {
+        pow_sum += y[k] * y[k];
+      }
+      if (output) {
+        memcpy(output + start, y, n * sizeof(double));
+      }
+    }
+  }
+
+  return pow_sum;
+}
+
+void fft_prepare(int length, int order) {
+
+  int M = fft_block_size(order);
+  long num_blocks = (length + (M - order) - 1) / (M - order);
+  int rest = num_blocks % FFT_BATCH;
+  fft_scratch* s = get_scratch(M);
+
+  // the lookups overlap_save makes, on the same (scratch) arrays: real
+  // signals' batches, then I/Q ones (each block's I and Q together)
+  fft_plan(M, FFT_R2C, s->block, s->H);
+  int batches[4] = {num_blocks < FFT_BATCH ? 0 : FFT_BATCH, rest,
+                    num_blocks < FFT_BATCH / 2 ? 0 : FFT_BATCH,
+                    2 * (num_blocks % (FFT_BATCH / 2))};
+  for (int b = 0; b < 4; b++) {
+    if (batches[b] > 0) {
+      fft_plan_many(M, batches[b], fft_threads, FFT_R2C, s->block, s->spec);
+      fft_plan_many(M, batches[b], fft_threads, FFT_C2R, s->spec, s->block);
+    }
+  }
+}
+
+int fft_convolve(int length, double input_signal[],
+                 int order, double coeffs[],
+                 double output_signal[]) {
+
+  overlap_save(length, input_signal, 0.0, 0, 0.0, order, coeffs, output_signal);
+  return 0;
+}
+
+int fft_convolve_dc_and_compute_power(int length, double input_signal[],
+                                      double dc, int order, double coeffs[],
+                                      double* power) {
+
+  *power = overlap_save(length, input_signal, dc, 0, 0.0, order, coeffs, 0) / length;
+  return 0;
+}
+
+// The real low pass on each of the mixed I and Q, as in
+// convolve_iq_and_compute_power; overlap_save mixes each block as it
+// fills the transform input, so the scratch is the per-thread batch
+int fft_convolve_iq_and_compute_power(int length, double iq[], double dc_i, double dc_q,
+                                      double omega, int order, double coeffs[],
+                                      double* power) {
+
+  nco osc;
+  nco_init(&osc, omega);
+  *power = overlap_save(length, iq, dc_i, &osc, dc_q, order, coeffs, 0) / length;
+  return 0;
+}
@@ -0,0 +1,89 @@
+#ifndef _fft
+#define _fft
+
+#include <fftw3.h>
+
+/*
+ *  FFT support: an FFTW plan cache, wisdom files, and overlap-save FIR
+ *  filtering on top of them
+ *
+ *  Plans are expensive to make (FFTW_MEASURE actually runs candidate
+ *  transforms) but can be executed on any arrays of the same size and
+ *  alignment, from any thread.  So plans are made once per (size,
+ *  direction, alignment), kept for the whole run and shared by every band
+ *  and thread.  Wisdom saved by one run lets the next one skip measuring.
+ *
+ *  Programs using this must be built with -pthread and linked with
+ *  -lfftw3_threads -lfftw3.
+ */
+
+typedef enum {FFT_R2C, FFT_C2R} fft_direction;
+
+#define FFT_BLOCK 4096   // smallest overlap-save block
+#define FFT_BATCH 16     // overlap-save blocks per FFTW call
+
+// Planner effort for new plans: FFTW_ESTIMATE, FFTW_MEASURE (default),
+// FFTW_PATIENT or FFTW_EXHAUSTIVE
+void fft_set_planner(unsigned flags);
+
+// Load wisdom saved by an earlier run / save it for the next one.
+// Return 0 on success.
+int  fft_import_wisdom(char* path);
+int  fft_export_wisdom(char* path);
+
+// Cached plan for a size n real transform in the given direction, for
+// arrays aligned like in and out.  Execute it with fftw_execute_dft_r2c/
+// fftw_execute_dft_c2r on the actual arrays.  Thread safe; the plan
+// belongs to the cache.
+fftw_plan fft_plan(int n, fft_direction dir, void* in, void* out);
+
+// Same for howmany transforms laid out back to back (n reals or n / 2 + 1
+// complex bins apart), executed by nthreads threads (fft_set_threads)
+fftw_plan fft_plan_many(int n, int howmany, int nthreads,
+                        fft_direction dir, void* in, void* out);
+
+// Let the overlap-save transforms each use nthreads threads (fftw3_threads).
+// FFTW's work runs on a pool of persistent helper threads, at most one
+// pinned to each processor.  The helpers of a thread that called
+// fft_pin_threads(first, num) are those of processors first + 1 ..
+// first + nthreads - 1 (mod num), started by that call, the caller itself
+// doing the first share of the work; call it after fft_set_threads.
+// Threads that never called it get unpinned helpers, started on first use.
+void fft_set_threads(int nthreads);
+void fft_pin_threads(int first_processor, int num_processors);
+
+// Stop the helper pool and drop all plans and FFTW's thread state, at
+// the end of a run
+void fft_cleanup();
+
+// How many plans were made and how many lookups found one already made
+void fft_plan_stats(long* made, long* reused);
+
+// Drop all cached plans
+void fft_forget_plans();
+
+// Overlap-save block (transform) size used for filters of this order,
+// FFT_BLOCK or bigger so at least half of each block is new output
+int  fft_block_size(int order);
+
+// Make now every plan the overlap-save functions will look up for a
+// (real or I/Q) signal of length samples and filters of this order at
+// the current fft_set_threads count (full and last batches, both
+// directions), so that timing or a run with wisdom doesn't pay for
+// planning
+void fft_prepare(int length, int order);
+
+// FFT equivalents of convolve, convolve_dc_and_compute_power and
+// convolve_iq_and_compute_power, same arguments and same (aperiodic,
+// causal) results up to rounding
+int  fft_convolve(int length, double input_signal[],
+                  int order, double coeffs[],
+                  double output_signal[]);
+int  fft_convolve_dc_and_compute_power(int length, double input_signal[],
+                                       double dc, int order, double coeffs[],
+                                       double* power);
+int  fft_convolve_iq_and_compute_power(int length, double iq[], double dc_i, double dc_q,
+                                       double omega, int order, double coeffs[],
+                                       double* power);
+
+#endif
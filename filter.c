@@ -2,9 +2,81 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <stdio.h>
-#include <fftw3.h>
+#include <string.h>
+#include <complex.h>
 
 #include "filter.h"
+#include "fir_kernel.h"
+
+
+// Kernel variants, best first.  Only x86-64 builds have the SIMD ones.
+typedef struct fir_variant {
+  char* name;
+  fir_power_kernel power;
+  iir_power_kernel iir;
+} fir_variant;
+
+static fir_variant fir_variants[] = {
+#ifdef __x86_64__
+  {"avx512",  fir_power_avx512, iir_power_avx512},
+  {"avx2",    fir_power_avx2,   iir_power_avx2},
+  {"sse4.2",  fir_power_sse42,  iir_power_sse42},
+#endif
+  {"generic", fir_power_generic, iir_power_generic},
+};
+
+#define NUM_FIR_VARIANTS (sizeof(fir_variants) / sizeof(fir_variants[0]))
+
+static fir_variant* fir_current = &fir_variants[NUM_FIR_VARIANTS - 1];
+
+static int fir_supported(fir_variant* v) {
+#ifdef __x86_64__
+  if (!strcmp(v->name, "avx512")) {
+    return __builtin_cpu_supports("avx512f");
+  } else if (!strcmp(v->name, "avx2")) {
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+  } else if (!strcmp(v->name, "sse4.2")) {
+    return __builtin_cpu_supports("sse4.2");
+  }
+#endif
+  return 1;
+}
+
+int filter_use_isa(char* name) {
+  for (int v = 0; v < NUM_FIR_VARIANTS; v++) {
+    if (!strcmp(fir_variants[v].name, name)) {
+      if (!fir_supported(&fir_variants[v])) {
+        return -1;
+      }
+      fir_current = &fir_variants[v];
+      return 0;
+    }
+  }
+  return -1;
+}
+
+char* filter_isa() {
+  return fir_current->name;
+}
+
+// Pick the kernels once, before main, so threads never race on it
+__attribute__((constructor))
+static void select_fir_variant() {
+#ifdef __x86_64__
+  __builtin_cpu_init();
+#endif
+  for (int v = NUM_FIR_VARIANTS - 1; v >= 0; v--) {
+    if (fir_supported(&fir_variants[v])) {
+      fir_current = &fir_variants[v];
+    }
+  }
+
+  char* forced = getenv("FILTER_ISA");
+  if (forced && filter_use_isa(forced) < 0) {
+    fprintf(stderr, "FILTER_ISA=%s is unknown or not supported here, using %s\n",
+            forced, fir_current->name);
+  }
+}
 
 int generate_low_pass(double Fs, double Fc,
                       int order, double coeffs[]) {
@@ -99,6 +171,479 @@ int hamming_window(int order, double coeffs[]) {
 
 }
 
+/*
+ * Specified designs.  Instead of a hand-picked order with a Hamming
+ * window (about 53 dB, transition 3.3 Fs / order), ask for a stopband
+ * attenuation and a transition width and get the fewest taps that meet
+ * them.  Transitions are centered on the band edges, as with the
+ * windowed sincs, so band powers stay comparable.
+ */
+
+// Zeroth order modified Bessel function of the first kind, by its series
+static double bessel_i0(double x) {
+  double sum = 1;
+  double term = 1;
+  for (int k = 1; k < 64 && term > 1e-17 * sum; k++) {
+    term *= (x / (2 * k)) * (x / (2 * k));
+    sum += term;
+  }
+  return sum;
+}
+
+double kaiser_beta(double atten) {
+  if (atten > 50) {
+    return 0.1102 * (atten - 8.7);
+  } else if (atten >= 21) {
+    return 0.5842 * pow(atten - 21, 0.4) + 0.07886 * (atten - 21);
+  }
+  return 0;
+}
+
+int kaiser_window(int order, double beta, double coeffs[]) {
+  assert(order > 0 && !(order & 0x1));
+
+  double norm = bessel_i0(beta);
+  for (int n = 0; n <= order; n++) {
+    double r = (2.0 * n - order) / order;
+    coeffs[n] = coeffs[n] * bessel_i0(beta * sqrt(fmax(0.0, 1 - r * r))) / norm;
+  }
+  return 0;
+}
+
+// Even order at least n
+static int even_order(double n) {
+  int order = (int)ceil(n);
+  order += order & 0x1;
+  return order < 2 ? 2 : order;
+}
+
+/*
+ * Parks-McClellan (Remez exchange) for even order, symmetric filters:
+ * the amplitude A(w) = sum_{k=0}^{M} a_k cos(k w), M = order / 2, is the
+ * unique one whose weighted error against the desired 1 (pass) / 0 (stop)
+ * equioscillates at M + 2 frequencies.  Guess those, solve for the
+ * polynomial through them (barycentric Lagrange form, in x = cos w),
+ * move to the extrema of its error, repeat.
+ *
+ * In doubles the interpolation loses accuracy past several hundred taps
+ * and the exchange can stop converging; that is reported as -1, after
+ * writing the last iterate anyway.
+ */
+
+#define REMEZ_DENSITY 16
+#define EQUIRIPPLE_PASS 0.01    // passband ripple allowed, about 0.09 dB
+#define REMEZ_ITERATIONS 64
+
+typedef struct remez_grid {
+  int n;
+  int start[4];         // first point of each band, then n
+  double* f;            // cycles per sample, 0 .. 0.5
+  double* x;            // cos(2 pi f)
+  double* d;            // desired
+  double* w;            // weight
+} remez_grid;
+
+// Bands as (low, high, desired, weight), low..high in 0..0.5
+static int remez_make_grid(int M, int num_bands, double bands[][4], remez_grid* g) {
+  double delf = 0.5 / (REMEZ_DENSITY * (M + 1));
+  int n = 0;
+  for (int b = 0; b < num_bands; b++) {
+    n += (int)((bands[b][1] - bands[b][0]) / delf) + 2;
+  }
+  g->f = malloc(4 * (long)n * sizeof(double));
+  if (!g->f) {
+    return -1;
+  }
+  g->x = g->f + n;
+  g->d = g->x + n;
+  g->w = g->d + n;
+  g->n = 0;
+  for (int b = 0; b < num_bands; b++) {
+    g->start[b] = g->n;
+    int points = (int)((bands[b][1] - bands[b][0]) / delf) + 1;
+    for (int i = 0; i <= points; i++) {
+      double f = bands[b][0] + (bands[b][1] - bands[b][0]) * i / points;
+      g->f[g->n] = f;
+      g->x[g->n] = cos(2 * M_PI * f);
+      g->d[g->n] = bands[b][2];
+      g->w[g->n] = bands[b][3];
+      g->n++;
+    }
+  }
+  g->start[num_bands] = g->n;
+  return 0;
+}
+
+// Barycentric weights of the points x[ext[0..n)], up to a common factor.
+// Products of hundreds of differences over- or underflow, so they are
+// summed as logarithms and scaled by the largest before exponentiating.
+static void remez_weights(int n, int* ext, double* x, double* bw) {
+  char negative[n];
+  double top = -INFINITY;
+  for (int i = 0; i < n; i++) {
+    double log_p = 0;
+    negative[i] = 0;
+    for (int j = 0; j < n; j++) {
+      if (j != i) {
+        double d = x[ext[i]] - x[ext[j]];
+        log_p += log(fabs(d) + 1e-300);
+        negative[i] ^= d < 0;
+      }
+    }
+    bw[i] = -log_p;
+    top = fmax(top, bw[i]);
+  }
+  for (int i = 0; i < n; i++) {
+    bw[i] = (negative[i] ? -1 : 1) * exp(bw[i] - top);
+  }
+}
+
+// A at x from its values c[] at x[ext[0..n)]
+static double remez_eval(double xv, int n, int* ext, double* x, double* bw, double* c) {
+  double num = 0;
+  double den = 0;
+  for (int i = 0; i < n; i++) {
+    double dx = xv - x[ext[i]];
+    if (fabs(dx) < 1e-14) {
+      return c[i];
+    }
+    num += bw[i] / dx * c[i];
+    den += bw[i] / dx;
+  }
+  return num / den;
+}
+
+static int remez(int order, int num_bands, double bands[][4], double coeffs[]) {
+
+  int M = order / 2;
+  int r = M + 2;              // extremal frequencies
+  remez_grid g;
+  if (remez_make_grid(M, num_bands, bands, &g)) {
+    return -1;
+  }
+  if (g.n < r) {
+    free(g.f);
+    return -1;
+  }
+
+  int* ext = malloc(2 * (long)(g.n + r) * sizeof(int));
+  double* bw = malloc(3 * (long)r * sizeof(double));
+  double* err = malloc(g.n * sizeof(double));
+  if (!ext || !bw || !err) {
+    free(g.f);
+    free(ext);
+    free(bw);
+    free(err);
+    return -1;
+  }
+  int* found = ext + r;
+  double* c = bw + r;
+  double* ad = c + r;
+
+  // first guess: spread evenly over each band, the bands sharing them by
+  // width but each getting two, so a narrow passband is not skipped
+  int share[3];
+  int given = 0;
+  int widest = 0;
+  for (int b = 0; b < num_bands; b++) {
+    int points = g.start[b + 1] - g.start[b];
+    share[b] = (int)((long)r * points / g.n);
+    share[b] = share[b] < 2 ? 2 : share[b];
+    share[b] = share[b] > points ? points : share[b];
+    given += share[b];
+    widest = points > g.start[widest + 1] - g.start[widest] ? b : widest;
+  }
+  share[widest] += r - given;
+  for (int b = 0, i = 0; b < num_bands; b++) {
+    int points = g.start[b + 1] - g.start[b];
+    for (int j = 0; j < share[b]; j++) {
+      ext[i++] = g.start[b] + (share[b] > 1 ? (long)j * (points - 1) / (share[b] - 1) : 0);
+    }
+  }
+
+  int converged = 0;
+  for (int iter = 0; iter < REMEZ_ITERATIONS && !converged; iter++) {
+
+    // deviation delta and the values the polynomial takes at the
+    // extremals, alternating about the desired response
+    remez_weights(r, ext, g.x, bw);
+    double num = 0;
+    double den = 0;
+    for (int i = 0; i < r; i++) {
+      num += bw[i] * g.d[ext[i]];
+      den += (i & 1 ? -1 : 1) * bw[i] / g.w[ext[i]];
+    }
+    double delta = num / den;
+    for (int i = 0; i < r; i++) {
+      c[i] = g.d[ext[i]] - (i & 1 ? -1 : 1) * delta / g.w[ext[i]];
+    }
+    // interpolate through r - 1 of them
+    remez_weights(r - 1, ext, g.x, ad);
+
+    double emax = 0;
+    for (int k = 0; k < g.n; k++) {
+      double a = remez_eval(g.x[k], r - 1, ext, g.x, ad, c);
+      err[k] = g.w[k] * (g.d[k] - a);
+      emax = fmax(emax, fabs(err[k]));
+    }
+
+    // local extrema of the error (band edges count), at least |delta|
+    int nf = 0;
+    for (int k = 0; k < g.n; k++) {
+      int edge_lo = k == 0 || g.f[k - 1] >= g.f[k] || g.d[k - 1] != g.d[k];
+      int edge_hi = k == g.n - 1 || g.f[k + 1] <= g.f[k] || g.d[k + 1] != g.d[k];
+      double e = fabs(err[k]);
+      if (e < fabs(delta) * (1 - 1e-3)) {
+        continue;
+      }
+      // an extremum of the signed error: a positive peak or negative dip
+      double sgn = err[k] > 0 ? 1 : -1;
+      if ((edge_lo || sgn * err[k] >= sgn * err[k - 1]) &&
+          (edge_hi || sgn * err[k] > sgn * err[k + 1])) {
+        // alternation: of two in a row with the same sign keep the larger
+        if (nf > 0 && (err[found[nf - 1]] > 0) == (err[k] > 0)) {
+          if (e > fabs(err[found[nf - 1]])) {
+            found[nf - 1] = k;
+          }
+        } else {
+          found[nf++] = k;
+        }
+      }
+    }
+    // too many: drop from whichever end is smaller
+    int lo = 0;
+    while (nf - lo > r) {
+      if (fabs(err[found[lo]]) < fabs(err[found[nf - 1]])) {
+        lo++;
+      } else {
+        nf--;
+      }
+    }
+    if (nf - lo < r) {
+      break;                  // lost alternation
+    }
+
+    int same = 1;
+    for (int i = 0; i < r; i++) {
+      same &= ext[i] == found[lo + i];
+      ext[i] = found[lo + i];
+    }
+    converged = same || emax - fabs(delta) < 1e-6 * fabs(delta);
+  }
+
+  // A(w) at M + 1 equally spaced w, then the cosine coefficients by the
+  // inverse DCT-I; h[M +- k] = a_k / 2, h[M] = a_0
+  remez_weights(r - 1, ext, g.x, ad);
+  double A[M + 1];
+  for (int j = 0; j <= M; j++) {
+    A[j] = remez_eval(cos(M_PI * j / M), r - 1, ext, g.x, ad, c);
+  }
+  for (int k = 0; k <= M; k++) {
+    double s = 0;
+    for (int j = 0; j <= M; j++) {
+      double t = A[j] * cos(M_PI * k * j / M);
+      s += (j == 0 || j == M) ? t / 2 : t;
+    }
+    double a = s * 2 / M;
+    if (k == 0 || k == M) {
+      a /= 2;
+    }
+    if (k == 0) {
+      coeffs[M] = a;
+    } else {
+      coeffs[M - k] = coeffs[M + k] = a / 2;
+    }
+  }
+
+  free(g.f);
+  free(ext);
+  free(bw);
+  free(err);
+  return converged ? 0 : -1;
+}
+
+int generate_equiripple_band_pass(double Fs, double Fcl, double Fch, double transition,
+                                  double atten, int order, double coeffs[]) {
+  assert(order > 0 && !(order & 0x1));
+  assert(Fs > 0 && Fcl > 0 && Fcl < Fch && Fch < Fs / 2 && transition > 0);
+
+  double tw = transition / Fs;
+  double lo = Fcl / Fs;
+  double hi = Fch / Fs;
+  // a band narrower than the transition keeps a sliver of passband
+  double pass_lo = fmin(lo + tw / 2, (lo + hi) / 2 - 1e-6);
+  double pass_hi = fmax(hi - tw / 2, (lo + hi) / 2 + 1e-6);
+  // stopband error weighted so that hitting atten leaves EQUIRIPPLE_PASS
+  double stop_weight = EQUIRIPPLE_PASS / pow(10, -atten / 20);
+
+  double bands[3][4];
+  int n = 0;
+  if (lo - tw / 2 > 0) {
+    bands[n][0] = 0;
+    bands[n][1] = lo - tw / 2;
+    bands[n][2] = 0;
+    bands[n++][3] = stop_weight;
+  }
+  bands[n][0] = fmax(pass_lo, 0);
+  bands[n][1] = fmin(pass_hi, 0.5);
+  bands[n][2] = 1;
+  bands[n++][3] = 1;
+  if (hi + tw / 2 < 0.5) {
+    bands[n][0] = hi + tw / 2;
+    bands[n][1] = 0.5;
+    bands[n][2] = 0;
+    bands[n++][3] = stop_weight;
+  }
+
+  return remez(order, n, bands, coeffs);
+}
+
+int design_band_pass(filter_spec* spec, double Fs, double Fcl, double Fch,
+                     int order, double coeffs[]) {
+  switch (spec->design) {
+    case DESIGN_KAISER:
+      generate_band_pass(Fs, Fcl, Fch, order, coeffs);
+      return kaiser_window(order, kaiser_beta(spec->atten), coeffs);
+    case DESIGN_EQUIRIPPLE:
+      if (generate_equiripple_band_pass(Fs, Fcl, Fch, spec->transition, spec->atten,
+                                        order, coeffs) == 0) {
+        return 0;
+      }
+      // too long to converge: Kaiser of the same order instead
+      generate_band_pass(Fs, Fcl, Fch, order, coeffs);
+      return kaiser_window(order, kaiser_beta(spec->atten), coeffs);
+    default:
+      generate_band_pass(Fs, Fcl, Fch, order, coeffs);
+      return hamming_window(order, coeffs);
+  }
+}
+
+// Worst attenuation (dB) of the filter over 0..Fcl - t/2 and Fch + t/2..Fs/2,
+// the edges included since the worst is usually right there
+static double stopband_attenuation(double Fs, double Fcl, double Fch, double transition,
+                                   int order, double coeffs[]) {
+  double stops[2][2] = {{0, Fcl - transition / 2}, {Fch + transition / 2, Fs / 2}};
+  int M = order / 2;
+  double peak = 0;
+  for (int s = 0; s < 2; s++) {
+    double width = stops[s][1] - stops[s][0];
+    if (width < 0) {
+      continue;
+    }
+    // 32 points per sidelobe or so
+    int points = (int)(32 * (order + 1) * width / (Fs / 2)) + 1;
+    for (int p = 0; p <= points; p++) {
+      double f = stops[s][0] + width * p / points;
+      // symmetric: A(f) = h[M] + 2 sum_k h[M - k] cos(2 pi f k / Fs),
+      // a Chebyshev series in x = cos(2 pi f / Fs), summed by Clenshaw
+      double x = cos(2 * M_PI * f / Fs);
+      double b1 = 0;
+      double b2 = 0;
+      for (int k = M; k >= 1; k--) {
+        double b = 2 * coeffs[M - k] + 2 * x * b1 - b2;
+        b2 = b1;
+        b1 = b;
+      }
+      peak = fmax(peak, fabs(coeffs[M] + x * b1 - b2));
+    }
+  }
+  return peak > 0 ? -20 * log10(peak) : INFINITY;
+}
+
+// 1 if the filter design_band_pass makes at this order (a Kaiser one
+// where the exchange does not converge) meets the spec, 0 if not, -1 if
+// out of memory
+static int meets_spec(filter_spec* spec, double Fs, double Fcl, double Fch, int order) {
+  double* c = malloc((order + 1) * sizeof(double));
+  if (!c) {
+    return -1;
+  }
+  design_band_pass(spec, Fs, Fcl, Fch, order, c);
+  int rc = stopband_attenuation(Fs, Fcl, Fch, spec->transition, order, c) >= spec->atten;
+  free(c);
+  return rc;
+}
+
+int design_min_order(filter_spec* spec, double Fs, double Fcl, double Fch) {
+
+  double df = spec->transition / Fs;
+  int order;
+  switch (spec->design) {
+    case DESIGN_KAISER:
+      order = even_order((spec->atten - 7.95) / (14.36 * df));
+      break;
+    case DESIGN_EQUIRIPPLE:
+      // Kaiser's estimate, -20 log10(sqrt(pass ripple * stop ripple))
+      order = even_order((spec->atten / 2 - 10 * log10(EQUIRIPPLE_PASS) - 13) / (14.6 * df));
+      break;
+    default:
+      // Hamming is ~53 dB whatever the order; only the width is asked for
+      return even_order(3.3 / df);
+  }
+  if (order > DESIGN_MAX_ORDER) {
+    order = DESIGN_MAX_ORDER;
+  }
+
+  // The estimates are close, not guaranteed.  Bracket the answer between
+  // an order that fails (fail, 0 = none) and one checked to meet the spec
+  // (meet), stepping away from the estimate by doubling steps, then
+  // bisect.  Every answer returned has been checked.
+  int fail = 0;
+  int meet = 0;
+  int rc = meets_spec(spec, Fs, Fcl, Fch, order);
+  int step = 2;
+  if (rc == 1) {
+    meet = order;
+    while (meet - step >= 2 && (rc = meets_spec(spec, Fs, Fcl, Fch, meet - step)) == 1) {
+      meet -= step;
+      step *= 2;
+    }
+    fail = meet - step >= 2 ? meet - step : 0;
+  } else if (rc == 0) {
+    fail = order;
+    while (rc == 0 && fail < DESIGN_MAX_ORDER) {
+      int next = fail + step < DESIGN_MAX_ORDER ? fail + step : DESIGN_MAX_ORDER;
+      rc = meets_spec(spec, Fs, Fcl, Fch, next);
+      if (rc == 0) {
+        fail = next;
+        step *= 2;
+      } else if (rc == 1) {
+        meet = next;
+      }
+    }
+  }
+  while (rc >= 0 && meet > 0 && meet - fail > 2) {
+    int mid = fail + (meet - fail) / 4 * 2;
+    rc = meets_spec(spec, Fs, Fcl, Fch, mid);
+    if (rc == 1) {
+      meet = mid;
+    } else if (rc == 0) {
+      fail = mid;
+    }
+  }
+
+  return rc >= 0 && meet > 0 ? meet : -1;
+}
+
+int filter_spec_of(char* arg, filter_spec* spec) {
+  char name[16];
+  spec->atten = 60;
+  spec->transition = 0;
+  if (sscanf(arg, "%15[a-z]:%lf:%lf", name, &spec->atten, &spec->transition) < 1) {
+    return -1;
+  }
+  if (!strcmp(name, "hamming")) {
+    spec->design = DESIGN_HAMMING;
+  } else if (!strcmp(name, "kaiser")) {
+    spec->design = DESIGN_KAISER;
+  } else if (!strcmp(name, "remez")) {
+    spec->design = DESIGN_EQUIRIPPLE;
+  } else {
+    return -1;
+  }
+  return spec->atten > 0 && spec->transition >= 0 ? 0 : -1;
+}
+
 // Simple (slow) convolution
 // output must be same length as input.  coeffs assumed to be
 int convolve(int length, double input_signal[],
@@ -121,96 +666,697 @@ int convolve(int length, double input_signal[],
 }
 
 
-// Simple (slow) convolution combined with power estimate for output
+// Convolution combined with power estimate for output
 int convolve_and_compute_power(int length, double input_signal[],
                                int order, double coeffs[],
                                double* power) {
 
+  // with no DC the edge and kernel sums are exactly the ones the plain
+  // aperiodic model computes
+  return convolve_dc_and_compute_power(length, input_signal, 0.0,
+                                       order, coeffs, power);
+}
+
+// Power of the filter output for the input with dc subtracted, without
+// rewriting the input.  Since the filter is linear, each output is the
+// plain convolution minus dc times the sum of the coefficients it used:
+// all of them once the filter is past the start (i >= order), a prefix of
+// them before that.
+int convolve_dc_and_compute_power(int length, double input_signal[],
+                                  double dc, int order, double coeffs[],
+                                  double* power) {
+
   double pow_sum = 0;
+  double prefix = 0;     // sum of coeffs[0..i]
+  int edge = order < length ? order : length;
+
+  for (int i = 0; i < edge; i++) {
+    double cur_sum = 0;
+    prefix += coeffs[i];
+    for (int j = i; j >= 0; j--) {
+      cur_sum += input_signal[i - j] * coeffs[j];
+    }
+    cur_sum -= dc * prefix;
+    pow_sum += cur_sum * cur_sum;
+  }
+
+  double total = 0;
+  for (int j = 0; j <= order; j++) {
+    total += coeffs[j];
+  }
+  double offset = dc * total;
+
+  // past the edge every tap has input, so no bounds checks
+  pow_sum += fir_current->power(edge, length, input_signal, offset, order, coeffs);
+
+  *power = pow_sum / length;
+
+  return 0;
+}
+
+// Outputs sampled together: single outputs would each pay the kernel's
+// setup, so the sample is of runs of this many consecutive outputs
+#define APPROX_RUN 64
+
+// Stratified sampling: one run drawn at random from each stretch of
+// stride runs, by a generator of our own so results repeat from run to run
+int convolve_dc_and_estimate_power(int length, double input_signal[],
+                                   double dc, int order, double coeffs[],
+                                   int stride, unsigned seed,
+                                   double* power, double* error) {
+
+  assert(stride > 0);
+
+  // the edge, where the taps run off the start, exactly
+  double edge_sum = 0;
+  double prefix = 0;
+  int edge = order < length ? order : length;
+  for (int i = 0; i < edge; i++) {
+    double cur_sum = 0;
+    prefix += coeffs[i];
+    for (int j = i; j >= 0; j--) {
+      cur_sum += input_signal[i - j] * coeffs[j];
+    }
+    cur_sum -= dc * prefix;
+    edge_sum += cur_sum * cur_sum;
+  }
+
+  double total = 0;
+  for (int j = 0; j <= order; j++) {
+    total += coeffs[j];
+  }
+  double offset = dc * total;
+
+  // the rest from a sample of runs of its outputs: the mean square of
+  // each run, and the spread of those for the standard error
+  long rest = length - edge;
+  long stretch = (long)stride * APPROX_RUN;
+  if (stride == 1 || rest < stretch) {
+    // nothing to gain from sampling: all of it
+    *power = edge_sum / length;
+    if (rest > 0) {
+      *power += fir_current->power(edge, length, input_signal, offset, order, coeffs) / length;
+    }
+    *error = 0;
+    return 0;
+  }
+  unsigned long state = seed * 2654435761UL + 1;
+  double sum = 0;
+  double sum_sq = 0;
+  double sampled = 0;
+  long m = 0;
+  for (long s = edge; s + APPROX_RUN <= length; s += stretch) {
+    state = state * 6364136223846793005UL + 1442695040888963407UL;
+    long span = (length - s < stretch ? length - s : stretch) - APPROX_RUN + 1;
+    long i = s + (long)((state >> 33) % span);
+    double v = fir_current->power(i, i + APPROX_RUN, input_signal, offset, order, coeffs) /
+               APPROX_RUN;
+    sum += v;
+    sum_sq += v * v;
+    sampled += APPROX_RUN;
+    m++;
+  }
+
+  double mean = sum / m;
+  double var = m > 1 ? fmax(0.0, (sum_sq - m * mean * mean) / (m - 1)) : mean * mean;
+  // without replacement: the finite population correction
+  double se = sqrt(var / m * fmax(0.0, 1 - sampled / rest));
+
+  *power = (edge_sum + rest * mean) / length;
+  *error = APPROX_Z * rest * se / length;
+
+  return 0;
+}
+
+// Convolution of one block of a stream, history is in input_signal[-order..-1]
+int convolve_continue(int length, double input_signal[],
+                      int order, double coeffs[],
+                      double output_signal[]) {
 
   for (int i = 0; i < length; i++) {
     double cur_sum = 0;
     for (int j = order; j >= 0; j--) {
-      // Use coeff only if there is input signal
-      // that matches, otherwise assume input signal
-      // is zero (aperiodic model)
-      if ((i - j) >= 0 && (i - j) < length) {
-        // Causal model, use inputs up to this point
-        cur_sum += input_signal[i - j] * coeffs[j];
+      cur_sum += input_signal[i - j] * coeffs[j];
+    }
+    output_signal[i] = cur_sum;
+  }
+  return 0;
+}
+
+int convolve_continue_and_compute_power(int length, double input_signal[],
+                                        int order, double coeffs[],
+                                        double* power) {
+
+  // the kernels index outputs from the start of the history
+  *power = length > 0 ?
+    fir_current->power(order, order + length, input_signal - order, 0, order, coeffs) / length : 0;
+  return 0;
+}
+
+// Bounds on sum_k |H_k(w)|^2 over 0 <= w <= pi for a bank of symmetric
+// filters.  For a symmetric filter of order 2K, |H(w)| = |A(w)| with
+//
+//   A(w) = c[K] + 2 sum_{m=1..K} c[K+m] cos(m w)
+//
+// G(w) = sum_k A_k(w)^2 is a trigonometric polynomial of degree `order`, so
+// by Bernstein's inequality |G'(w)| <= order * max G.  Sampling G on a grid
+// of spacing d therefore bounds the true extremes to within
+// eps = order * d / 2 of the grid extremes, which we fold into the result.
+#define GAIN_GRID_PER_ORDER 32
+
+int power_gain_bounds(int order, int num_filters, double coeffs[],
+                      double* gmin, double* gmax) {
+  assert(order > 0 && !(order & 0x1));
+  assert(num_filters > 0);
+
+  int K = order / 2;
+  int points = GAIN_GRID_PER_ORDER * order;
+  double d = M_PI / points;
+  double* gain = calloc(points + 1, sizeof(double));
+
+  if (!gain) {
+    return -1;
+  }
+
+  for (int k = 0; k < num_filters; k++) {
+    double* c = coeffs + (long)k * (order + 1);
+    for (int p = 0; p <= points; p++) {
+      double w = p * d;
+      // cos(m w) by the Chebyshev recurrence
+      double cprev = 1.0;
+      double ccur = cos(w);
+      double twoc = 2.0 * ccur;
+      double a = c[K];
+      for (int m = 1; m <= K; m++) {
+        a += 2.0 * c[K + m] * ccur;
+        double cnext = twoc * ccur - cprev;
+        cprev = ccur;
+        ccur = cnext;
       }
+      gain[p] += a * a;
     }
-    pow_sum += cur_sum * cur_sum;
   }
 
+  double lo = gain[0];
+  double hi = gain[0];
+  for (int p = 1; p <= points; p++) {
+    lo = fmin(lo, gain[p]);
+    hi = fmax(hi, gain[p]);
+  }
+  free(gain);
+
+  double eps = order * d / 2;
+  assert(eps < 1.0);
+
+  *gmax = hi / (1.0 - eps);
+  *gmin = fmax(0.0, lo - eps * (*gmax));
+
+  return 0;
+}
+
+/*
+ * IIR resonator bank.  Each band is a 4th order Butterworth band pass
+ * (the 2nd order low pass prototype mapped to the band, then the
+ * bilinear transform), as two biquads: about 12 flops a band a sample
+ * against 2 (order + 1) for a FIR, at the price of a gentle skirt
+ * (24 dB an octave away from the band) and a nonlinear phase, neither of
+ * which matter for a power.  The bands run side by side in vector lanes.
+ */
+
+// The two biquads of the band low..high (Hz): a1, a2 of each, and the
+// gain that makes the response 1 at the center
+static double iir_band(double Fs, double low, double high, double c[4]) {
+  // prewarped edges, kept off 0 and Nyquist where tan degenerates
+  double wl = tan(M_PI * fmax(low / Fs, 1e-4));
+  double wh = tan(M_PI * fmin(high / Fs, 0.4995));
+  double w0 = sqrt(wl * wh);
+  double B = wh - wl;
+
+  // the 2nd order prototype's pole pair p, conj(p) maps to the band
+  // poles s = (p B +- sqrt(p^2 B^2 - 4 w0^2)) / 2, and their conjugates
+  double complex p = (-1 + I) / sqrt(2);
+  double complex root = csqrt(p * p * B * B - 4 * w0 * w0);
+  double complex s[2] = {(p * B + root) / 2, (p * B - root) / 2};
+  double complex num = 1;
+  double complex den = 1;
+  double complex zc = cexp(-I * 2 * atan(w0));   // z^-1 at the center
+  for (int k = 0; k < 2; k++) {
+    double complex z = (1 + s[k]) / (1 - s[k]);
+    c[2 * k] = -2 * creal(z);
+    c[2 * k + 1] = creal(z * conj(z));
+    num *= 1 - zc * zc;
+    den *= 1 + c[2 * k] * zc + c[2 * k + 1] * zc * zc;
+  }
+  return cabs(den / num);
+}
+
+int iir_bank_power(int length, double input_signal[], double dc, double Fs,
+                   int num_bands, double low[], double high[], double power[]) {
+
+  int padded = (num_bands + IIR_MAX_LANES - 1) / IIR_MAX_LANES * IIR_MAX_LANES;
+  double* coeffs = calloc(9 * (long)padded, sizeof(double));
+  if (!coeffs) {
+    return -1;
+  }
+  double* state = coeffs + 4 * padded;
+  double* sum = state + 4 * padded;
+  double gain[num_bands];
+  for (int b = 0; b < num_bands; b++) {
+    double c[4];
+    gain[b] = iir_band(Fs, low[b], high[b], c);
+    for (int k = 0; k < 4; k++) {
+      coeffs[k * padded + b] = c[k];
+    }
+  }
+
+  // the first two outputs by hand, the samples before the start being 0
+  // (dc, before it is subtracted); after that 1 - z^-2 removes the dc
+  for (int i = 0; i < 2 && i < length; i++) {
+    double v = input_signal[i] - dc;
+    for (int b = 0; b < num_bands; b++) {
+      double* y = state + b;
+      double yi = v - coeffs[b] * y[0] - coeffs[padded + b] * y[padded];
+      double zi = (yi - y[padded]) - coeffs[2 * padded + b] * y[2 * padded] -
+                  coeffs[3 * padded + b] * y[3 * padded];
+      y[padded] = y[0];
+      y[0] = yi;
+      y[3 * padded] = y[2 * padded];
+      y[2 * padded] = zi;
+      sum[b] += zi * zi;
+    }
+  }
+  if (length > 2) {
+    fir_current->iir(2, length, input_signal, padded, coeffs, state, sum);
+  }
+
+  for (int b = 0; b < num_bands; b++) {
+    power[b] = sum[b] * gain[b] * gain[b] / length;
+  }
+  free(coeffs);
+  return 0;
+}
+
+// Targets updated together in the inner loop; small enough for the
+// states to stay in registers, one vector of them per ISA
+#define GOERTZEL_LANES 8
+// Samples per restart of the recurrence.  Restarting and rotating the
+// partial transform keeps the error from growing with the input length
+#define GOERTZEL_BLOCK 4096
+
+int goertzel_bank(int length, double input_signal[], double dc, long first,
+                  int num_targets, double omega[], double re[], double im[]) {
+
+  for (int t0 = 0; t0 < num_targets; t0 += GOERTZEL_LANES) {
+    int lanes = num_targets - t0 < GOERTZEL_LANES ? num_targets - t0 : GOERTZEL_LANES;
+    double c[GOERTZEL_LANES];
+    for (int t = 0; t < GOERTZEL_LANES; t++) {
+      c[t] = t < lanes ? 2 * cos(omega[t0 + t]) : 0;
+    }
+
+    for (int b = 0; b < length; b += GOERTZEL_BLOCK) {
+      int n = length - b < GOERTZEL_BLOCK ? length - b : GOERTZEL_BLOCK;
+      double* x = input_signal + b;
+      double s1[GOERTZEL_LANES] = {0};
+      double s2[GOERTZEL_LANES] = {0};
+
+      for (int i = 0; i < n; i++) {
+        double v = x[i] - dc;
+        for (int t = 0; t < GOERTZEL_LANES; t++) {
+          double s0 = v + c[t] * s1[t] - s2[t];
+          s2[t] = s1[t];
+          s1[t] = s0;
+        }
+      }
+
+      // s1 - e^{-i w} s2 is sum_i x[i] e^{i w (n - 1 - i)}; rotate by
+      // e^{-i w (start + n - 1)} to reference it to sample 0 of the stream
+      for (int t = 0; t < lanes; t++) {
+        double w = omega[t0 + t];
+        double yr = s1[t] - cos(w) * s2[t];
+        double yi = sin(w) * s2[t];
+        double phase = -w * (double)(first + b + n - 1);
+        double pr = cos(phase);
+        double pi = sin(phase);
+        re[t0 + t] += yr * pr - yi * pi;
+        im[t0 + t] += yr * pi + yi * pr;
+      }
+    }
+  }
+
+  return 0;
+}
+
+double goertzel_power(long length, double omega, double re, double im) {
+  // a tone A cos(w n + p) gives |X| = A length / 2, so this is A^2 / 2;
+  // at DC and Nyquist there is no negative frequency image to fold in
+  double scale = (omega > 1e-12 && omega < M_PI - 1e-12) ? 2.0 : 1.0;
+  return scale * (re * re + im * im) / ((double)length * length);
+}
+
+sliding_dft* sliding_dft_create(int window, double dc,
+                                int num_targets, double omega[]) {
+
+  sliding_dft* s = malloc(sizeof(sliding_dft));
+  if (!s) {
+    return 0;
+  }
+  s->window = window;
+  s->dc = dc;
+  s->num_targets = num_targets;
+  s->pos = 0;
+  s->count = 0;
+  s->history = calloc(window, sizeof(double));
+  s->state = calloc(7 * (long)num_targets, sizeof(double));
+  if (!s->history || !s->state) {
+    free(s->history);
+    free(s->state);
+    free(s);
+    return 0;
+  }
+  s->re = s->state;
+  s->im = s->re + num_targets;
+  s->omega = s->im + num_targets;
+  s->rot_re = s->omega + num_targets;
+  s->rot_im = s->rot_re + num_targets;
+  s->out_re = s->rot_im + num_targets;
+  s->out_im = s->out_re + num_targets;
+  for (int t = 0; t < num_targets; t++) {
+    s->omega[t] = omega[t];
+    s->rot_re[t] = cos(omega[t]);
+    s->rot_im[t] = sin(omega[t]);
+    s->out_re[t] = cos(omega[t] * window);
+    s->out_im[t] = sin(omega[t] * window);
+  }
+  return s;
+}
+
+void sliding_dft_free(sliding_dft* s) {
+  if (s) {
+    free(s->history);
+    free(s->state);
+    free(s);
+  }
+}
+
+void sliding_dft_push(sliding_dft* s, int length, double input_signal[]) {
+
+  int T = s->num_targets;
+  double* re = s->re;
+  double* im = s->im;
+  double* rr = s->rot_re;
+  double* ri = s->rot_im;
+  double* orr = s->out_re;
+  double* oi = s->out_im;
+
+  for (int i = 0; i < length; i++) {
+    double in = input_signal[i] - s->dc;
+    double out = s->history[s->pos];
+    s->history[s->pos] = in;
+    if (++s->pos == s->window) {
+      s->pos = 0;
+    }
+
+    // Y_n = x[n] + e^{i w} Y_{n-1} - e^{i w W} x[n-W]
+    for (int t = 0; t < T; t++) {
+      double r = rr[t] * re[t] - ri[t] * im[t];
+      double j = rr[t] * im[t] + ri[t] * re[t];
+      re[t] = r + in - orr[t] * out;
+      im[t] = j - oi[t] * out;
+    }
+  }
+  s->count += length;
+}
+
+void sliding_dft_power(sliding_dft* s, double power[]) {
+  long n = s->count < s->window ? s->count : s->window;
+  for (int t = 0; t < s->num_targets; t++) {
+    power[t] = n > 0 ? goertzel_power(n, s->omega[t], s->re[t], s->im[t]) : 0;
+  }
+}
+
+// Half-band decimator: order HALFBAND_ORDER (4k + 2, so every other tap
+// but the center is zero), Hamming windowed sinc at a quarter of the
+// input rate.  Passes +-rate/8 and stops from 3 rate/8 at about 53 dB.
+#define HALFBAND_ORDER 14
+#define HALFBAND_CENTER (HALFBAND_ORDER / 2)
+#define HALFBAND_TAPS (HALFBAND_CENTER / 2 + 1)  // nonzero ones each side
+
+void nco_init(nco* osc, double omega) {
+  osc->omega = omega;
+  for (int j = 0; j < NCO_BLOCK; j++) {
+    osc->step_re[j] = cos(omega * j);
+    osc->step_im[j] = -sin(omega * j);
+  }
+}
+
+void nco_mix(nco* osc, long first, long num, double in_re[], double in_im[],
+             int stride, double dc_re, double dc_im,
+             double out_re[], double out_im[]) {
+
+  long i = 0;
+  while (i < num) {
+    long n = first + i;
+    long block = n / NCO_BLOCK;
+    int j0 = n % NCO_BLOCK;
+    long run = NCO_BLOCK - j0 < num - i ? NCO_BLOCK - j0 : num - i;
+    double base_re = cos(osc->omega * (double)(block * NCO_BLOCK));
+    double base_im = -sin(osc->omega * (double)(block * NCO_BLOCK));
+    double* sr = osc->step_re + j0;
+    double* si = osc->step_im + j0;
+    double* xr = in_re + n * stride;
+    double* yr = out_re + i;
+    double* yi = out_im + i;
+    if (in_im) {
+      double* xi = in_im + n * stride;
+      for (long k = 0; k < run; k++) {
+        double c = base_re * sr[k] - base_im * si[k];
+        double s = base_re * si[k] + base_im * sr[k];
+        double x = xr[k * stride] - dc_re;
+        double y = xi[k * stride] - dc_im;
+        yr[k] = x * c - y * s;
+        yi[k] = x * s + y * c;
+      }
+    } else {
+      for (long k = 0; k < run; k++) {
+        double x = xr[k * stride] - dc_re;
+        yr[k] = x * (base_re * sr[k] - base_im * si[k]);
+        yi[k] = x * (base_re * si[k] + base_im * sr[k]);
+      }
+    }
+    i += run;
+  }
+}
+
+int frontend_stages(double Fs, double width) {
+  int stages = 0;
+  // a stage at input rate R keeps +-R/8 clean
+  while (width / 2 <= Fs / 8 && stages < FRONTEND_MAX_STAGES) {
+    Fs /= 2;
+    stages++;
+  }
+  return stages;
+}
+
+long frontend_length(long num_samples, int stages) {
+  long D = 1L << stages;
+  return (num_samples + D - 1) / D;
+}
+
+int heterodyne_decimate(long num_samples, double input_signal[], double dc,
+                        double omega0, int stages, long first, long num,
+                        double out_re[], double out_im[]) {
+
+  if (num <= 0) {
+    return 0;
+  }
+  assert(stages >= 0 && stages <= FRONTEND_MAX_STAGES);
+
+  // input ranges [a[k], b[k]) of each stage, working back from the outputs
+  long a[FRONTEND_MAX_STAGES + 1];
+  long b[FRONTEND_MAX_STAGES + 1];
+  a[stages] = first;
+  b[stages] = first + num;
+  for (int k = stages - 1; k >= 0; k--) {
+    a[k] = 2 * a[k + 1] - HALFBAND_ORDER;
+    b[k] = 2 * (b[k + 1] - 1) + 1;
+  }
+
+  long len = b[0] - a[0];
+  double* re = out_re;
+  double* im = out_im;
+  double* scratch = 0;
+  if (stages > 0) {
+    scratch = malloc(2 * len * sizeof(double));
+    if (!scratch) {
+      return -1;
+    }
+    re = scratch;
+    im = scratch + len;
+  }
+
+  // mix down: z[n] = (x[n] - dc) e^{-i omega0 n}, zero outside the signal
+  nco osc;
+  nco_init(&osc, omega0);
+  long lo = a[0] < 0 ? 0 : a[0];
+  lo = lo < b[0] ? lo : b[0];
+  long hi = b[0] < num_samples ? b[0] : num_samples;
+  hi = hi > lo ? hi : lo;
+  memset(re, 0, (lo - a[0]) * sizeof(double));
+  memset(im, 0, (lo - a[0]) * sizeof(double));
+  nco_mix(&osc, lo, hi - lo, input_signal, 0, 1, dc, 0,
+          re + (lo - a[0]), im + (lo - a[0]));
+  memset(re + (hi - a[0]), 0, (b[0] - hi) * sizeof(double));
+  memset(im + (hi - a[0]), 0, (b[0] - hi) * sizeof(double));
+
+  // half-band stages, each in place (output m only reads inputs from 2m
+  // on), the last into out_re/out_im
+  double h[HALFBAND_TAPS];
+  for (int j = 0; j < HALFBAND_TAPS; j++) {
+    int k = 2 * j + 1;
+    h[j] = sin(M_PI * k / 2) / (M_PI * k) * (0.54 + 0.46 * cos(M_PI * k / HALFBAND_CENTER));
+  }
+
+  for (int k = 0; k < stages; k++) {
+    long n_out = b[k + 1] - a[k + 1];
+    double* yr = k == stages - 1 ? out_re : re;
+    double* yi = k == stages - 1 ? out_im : im;
+    for (long m = 0; m < n_out; m++) {
+      double* xr = re + 2 * m + HALFBAND_CENTER;
+      double* xi = im + 2 * m + HALFBAND_CENTER;
+      double sr = 0.5 * xr[0];
+      double si = 0.5 * xi[0];
+      for (int j = 0; j < HALFBAND_TAPS; j++) {
+        int d = 2 * j + 1;
+        sr += h[j] * (xr[-d] + xr[d]);
+        si += h[j] * (xi[-d] + xi[d]);
+      }
+      yr[m] = sr;
+      yi[m] = si;
+    }
+  }
+
+  free(scratch);
+  return 0;
+}
+
+// Samples mixed per block of the complex filter, so the mixed signal never
+// has to exist in full
+#define IQ_BLOCK 4096
+
+// The mixed block goes after the last order mixed samples of the one
+// before (zeros at the start), so the real power kernel runs on each of
+// re and im with no edge handling
+int convolve_iq_and_compute_power(int length, double iq[], double dc_i, double dc_q,
+                                  double omega, int order, double coeffs[],
+                                  double* power) {
+
+  double* re = malloc(2 * (order + IQ_BLOCK) * sizeof(double));
+  if (!re) {
+    return -1;
+  }
+  double* im = re + order + IQ_BLOCK;
+  memset(re, 0, order * sizeof(double));
+  memset(im, 0, order * sizeof(double));
+
+  nco osc;
+  nco_init(&osc, omega);
+  double pow_sum = 0;
+  for (long first = 0; first < length; first += IQ_BLOCK) {
+    int num = length - first < IQ_BLOCK ? length - first : IQ_BLOCK;
+    nco_mix(&osc, first, num, iq, iq + 1, 2, dc_i, dc_q, re + order, im + order);
+    pow_sum += fir_current->power(order, order + num, re, 0, order, coeffs);
+    pow_sum += fir_current->power(order, order + num, im, 0, order, coeffs);
+    memmove(re, re + num, order * sizeof(double));
+    memmove(im, im + num, order * sizeof(double));
+  }
+
+  free(re);
   *power = pow_sum / length;
 
   return 0;
 }
 
-// Fast Fourier Transform Convolution using FFTW3
-int fft_convolute(int length, double input_signal[],
-                                    int order, double coeffs[],
-                                    double output_signal[]) {
-  //find the smallest size to zero pad my signal to ensure that we are about to do dft properly.
-  int fft_size = 1; 
-  printf("presizeloop\n");
-  while(fft_size <= length + order) {
-    fft_size*=2;
-  }
-  printf("Padding begin\n");
-  double* padded_input = fftw_alloc_real(fft_size);
-  double* padded_coeffs = fftw_alloc_real(fft_size);
-  printf("Zero Fill begin\n");
-  // Zero-fill the arrays
-  memset(padded_input, 0, sizeof(double) * fft_size);
-  memset(padded_coeffs, 0, sizeof(double) * fft_size);
-  printf("%d\n", input_signal);
-  if (!input_signal) {
-    printf("Error: input_signal or coeffs is NULL\n");
+// Outputs per block of the channel filter: the taps loop runs outside, so
+// the inner loop over outputs vectorizes without reassociating sums
+#define AM_BLOCK 256
+
+int am_demod_init(am_demod* am, double Fs, double low, double high, int order) {
+
+  am->Fs = Fs;
+  am->carrier = (low + high) / 2;
+  am->width = high - low;
+  am->stages = frontend_stages(Fs, am->width);
+  am->rate = Fs / (1L << am->stages);
+  am->order = order;
+  am->coeffs = malloc((order + 1) * sizeof(double));
+  if (!am->coeffs) {
     return -1;
+  }
+  generate_low_pass(am->rate, am->width / 2, order, am->coeffs);
+  hamming_window(order, am->coeffs);
+  return 0;
 }
-if (!coeffs) {
-  printf("Error: input_signal or coeffs is NULL\n");
-  return -1;
+
+void am_demod_free(am_demod* am) {
+  free(am->coeffs);
+  am->coeffs = 0;
 }
-  printf("memory copy begin\n");
-  memcpy(padded_input, input_signal, sizeof(double)*length);
-  memcpy(padded_coeffs, coeffs, sizeof(double)*order);
-  printf("prefrequencies\n");
-  //create the frequency for input output and coeff
-  fftw_complex *input_frequency = fftw_malloc(sizeof(fftw_complex)*fft_size);
-  fftw_complex *coeff_frequency = fftw_malloc(sizeof(fftw_complex)*fft_size);
-  fftw_complex *output_frequency = fftw_malloc(sizeof(fftw_complex)*fft_size);
-  printf("presetup\n");
-  //Create the FFT Plans and run FFT
-  fftw_plan fwd_fft_input = fftw_plan_dft_r2c_1d(fft_size, padded_input, input_frequency, FFTW_ESTIMATE);
-  fftw_plan fwd_fft_coeff = fftw_plan_dft_r2c_1d(fft_size, padded_coeffs, coeff_frequency, FFTW_ESTIMATE);
-  fftw_plan rev_fft_input = fftw_plan_dft_c2r_1d(fft_size, output_frequency, output_signal, FFTW_ESTIMATE);
-  printf("preexecute\n");
-  fftw_execute(fwd_fft_input);
-  printf("precoeff");
-  fftw_execute(fwd_fft_coeff);
-  printf("preconvolute\n");
-  //Multiple in Frequency Domain
-  for (int i = 0; i < fft_size / 2 + 1; i++) {
-    output_frequency[i][0] = input_frequency[i][0] * coeff_frequency[i][0] - input_frequency[i][1] * coeff_frequency[i][1];  // Real part
-    output_frequency[i][1] = input_frequency[i][0] * coeff_frequency[i][1] + input_frequency[i][1] * coeff_frequency[i][0];  // Imaginary part
-  }
-  printf("preinverse\n");
-  //Inverse FFT
-  fftw_execute(rev_fft_input);
-
-  printf("predestroy\n");
-  //Free memory
-  fftw_destroy_plan(fwd_fft_coeff);
-  fftw_destroy_plan(fwd_fft_input);
-  fftw_destroy_plan(rev_fft_input);
-  fftw_free(input_frequency);
-  fftw_free(coeff_frequency);
-  fftw_free(output_frequency);
 
+long am_demod_length(am_demod* am, long num_samples) {
+  return frontend_length(num_samples, am->stages);
+}
+
+int am_demodulate(am_demod* am, long num_samples, double input_signal[],
+                  double dc, long first, long num, double output_signal[]) {
+
+  if (num <= 0) {
+    return 0;
+  }
+
+  // baseband outputs first - order .. first + num - 1, so the channel
+  // filter has its history
+  int order = am->order;
+  long len = num + order;
+  double* re = malloc(2 * len * sizeof(double));
+  if (!re) {
+    return -1;
+  }
+  double* im = re + len;
+  if (heterodyne_decimate(num_samples, input_signal, dc,
+                          2 * M_PI * am->carrier / am->Fs, am->stages,
+                          first - order, len, re, im)) {
+    free(re);
+    return -1;
+  }
+
+  double* c = am->coeffs;
+  for (long b = 0; b < num; b += AM_BLOCK) {
+    int n = num - b < AM_BLOCK ? num - b : AM_BLOCK;
+    double yr[AM_BLOCK];
+    double yi[AM_BLOCK];
+    for (int i = 0; i < n; i++) {
+      yr[i] = 0;
+      yi[i] = 0;
+    }
+    // output b + i is sum_j c[j] z[order + b + i - j]
+    for (int j = 0; j <= order; j++) {
+      double* xr = re + order + b - j;
+      double* xi = im + order + b - j;
+      for (int i = 0; i < n; i++) {
+        yr[i] += c[j] * xr[i];
+        yi[i] += c[j] * xi[i];
+      }
+    }
+    // the baseband carries half the amplitude of the real carrier
+    for (int i = 0; i < n; i++) {
+      output_signal[b + i] = 2 * sqrt(yr[i] * yr[i] + yi[i] * yi[i]);
+    }
+  }
+
+  free(re);
   return 0;
 }
+
 /* below taken from http://www.exstrom.com/journal/sigproc/liir.c */
 
 /**********************************************************************
@@ -52,17 +52,251 @@ int generate_band_stop(double Fs, double Fcl, double Fch,
 // coeffs[] array is overwritten. must have order+1 doubles
 int hamming_window(int order, double coeffs[]);
 
+// Kaiser window smoothing of filter, coeffs[] overwritten as above.
+// kaiser_beta gives the beta for a stopband attenuation in dB.
+double kaiser_beta(double atten);
+int    kaiser_window(int order, double beta, double coeffs[]);
+
+// Equiripple (Parks-McClellan) band pass: passband Fcl + t/2..Fch - t/2,
+// stopbands below Fcl - t/2 and above Fch + t/2, t = transition (Hz).
+// The stopband is weighted so that it is atten dB down when the passband
+// ripple is 1%; the order decides whether it gets there.  -1 if the
+// exchange did not converge (likely past ~500 taps); coeffs[] then hold
+// its last, not equiripple, iterate.
+int generate_equiripple_band_pass(double Fs, double Fcl, double Fch, double transition,
+                                  double atten, int order, double coeffs[]);
+
+// Band pass filters by specification rather than by order.  A design
+// plus the stopband attenuation (dB) and transition width (Hz) wanted;
+// design_min_order is the smallest order near the usual estimate whose
+// Fcl..Fch filter meets them (checked, not just estimated; attenuation is
+// not quite monotone in the order, so a smaller one far off may too), or
+// -1 if none up to DESIGN_MAX_ORDER does (or out of memory);
+// design_band_pass makes the filter of a given order.  DESIGN_HAMMING is
+// generate_band_pass + hamming_window, the default everywhere.
+// DESIGN_EQUIRIPPLE falls back to DESIGN_KAISER where the exchange does
+// not converge.
+#define DESIGN_MAX_ORDER 65536
+
+typedef enum {DESIGN_HAMMING, DESIGN_KAISER, DESIGN_EQUIRIPPLE} filter_design;
+
+typedef struct filter_spec {
+  filter_design design;
+  double atten;         // dB
+  double transition;    // Hz
+} filter_spec;
+
+int design_band_pass(filter_spec* spec, double Fs, double Fcl, double Fch,
+                     int order, double coeffs[]);
+int design_min_order(filter_spec* spec, double Fs, double Fcl, double Fch);
+
+// Parse hamming|kaiser|remez[:atten_db[:transition_hz]], attenuation
+// defaulting to 60 and transition to 0 (for the caller to fill in);
+// -1 if malformed
+int filter_spec_of(char* arg, filter_spec* spec);
+
 // Simple (slow) convolution
 // output must be same length as input.
 int convolve(int length, double input_signal[],
              int order, double coeffs[],
              double output_signal[]);
 
-// Simple (slow) convolution combined with power estimate for output
+// Convolution combined with power estimate for output (SIMD kernels)
 int convolve_and_compute_power(int length, double input_signal[],
                                int order, double coeffs[],
                                double* power);
 
+// Same, for the input with dc subtracted from every sample.  The input is
+// not modified, the DC is folded into the filter output instead.
+int convolve_dc_and_compute_power(int length, double input_signal[],
+                                  double dc, int order, double coeffs[],
+                                  double* power);
+
+// Estimate of convolve_dc_and_compute_power's power from about one output
+// in stride (short runs of consecutive outputs drawn at random, seed
+// picking which), the order edge outputs computed exactly.  *error is the half width of an
+// approximate confidence interval, APPROX_Z standard errors of the sample
+// mean: the exact power is in *power +- *error but for bad luck (or a
+// signal whose power sits in very few outputs, e.g. a short burst
+// between the samples).  stride 1 is exact, *error 0.
+#define APPROX_Z 4.0
+
+int convolve_dc_and_estimate_power(int length, double input_signal[],
+                                   double dc, int order, double coeffs[],
+                                   int stride, unsigned seed,
+                                   double* power, double* error);
+
+// The power kernels are built for several instruction sets and the best
+// one this CPU supports is picked at startup.  FILTER_ISA=avx512, avx2,
+// sse4.2 or generic in the environment, or filter_use_isa(), forces one,
+// e.g. for benchmarking.  filter_use_isa returns -1 if the name is unknown
+// or the CPU can't run it.  filter_isa names the one in use.
+int   filter_use_isa(char* name);
+char* filter_isa();
+
+// Convolution of one block of a longer stream.  input[-order..-1] must hold
+// the last order samples of the previous block (zeros at stream start),
+// so no edge handling is needed.  output must have room for length doubles.
+int convolve_continue(int length, double input_signal[],
+                      int order, double coeffs[],
+                      double output_signal[]);
+
+// Average power of the outputs of such a block, by the power kernels,
+// without writing them out
+int convolve_continue_and_compute_power(int length, double input_signal[],
+                                        int order, double coeffs[],
+                                        double* power);
+
+// Bounds over all frequencies on the summed power gain sum_k |H_k(f)|^2
+// of a bank of linear phase (symmetric) filters.  coeffs holds
+// num_filters filters of order+1 coefficients back to back.  The bounds
+// are guaranteed, not just sampled, so they can be used to prove results.
+int power_gain_bounds(int order, int num_filters, double coeffs[],
+                      double* gmin, double* gmax);
+
+// Power of input_signal less dc through a bank of num_bands IIR band
+// passes, band b covering low[b]..high[b] Hz: 4th order Butterworth, two
+// biquads, all bands updated together in one pass over the input (vector
+// lanes across bands).  Much cheaper than FIR filters of any useful
+// order, much less selective: a far-off strong tone still leaks in at
+// -24 dB an octave.  power[b] is the mean square output like
+// convolve_and_compute_power's.  -1 if out of memory.
+int iir_bank_power(int length, double input_signal[], double dc, double Fs,
+                   int num_bands, double low[], double high[], double power[]);
+
+// Goertzel detector bank: the DFT of input_signal less dc at num_targets
+// frequencies omega[] (radians per sample, 2 pi f / Fs) in one pass over
+// the input, the targets updated eight at a time.  The transform
+// X(w) = sum_n (x[n] - dc) e^{-i w n} is *added* to re[]/im[], n counted
+// from the start of the stream, input_signal[0] being sample first; so a
+// long signal can be split into pieces (e.g. one per thread) whose
+// results are summed.  Cost is O(length x num_targets).
+int goertzel_bank(int length, double input_signal[], double dc, long first,
+                  int num_targets, double omega[], double re[], double im[]);
+
+// Mean square of the tone in X(omega) over length samples: A^2 / 2 for
+// A cos(omega n + p), comparable to band powers
+double goertzel_power(long length, double omega, double re, double im);
+
+// Sliding DFT: the same transform over the last window samples, updated
+// in O(num_targets) per sample for streaming input.
+//
+//   sliding_dft* s = sliding_dft_create(window, dc, num_targets, omega);
+//   while (get_signal(block, n)) {
+//     sliding_dft_push(s, n, block);
+//     sliding_dft_power(s, power);   // num_targets tone powers, as above
+//   }
+//   sliding_dft_free(s);
+//
+// Rounding errors random walk, so drift stays around 1e-12 relative even
+// after 1e8 samples.
+typedef struct sliding_dft {
+  int window;
+  double dc;
+  int num_targets;
+  int pos;                // next slot of history
+  long count;             // samples pushed so far
+  double* history;        // the last window samples, ring buffer
+  double* state;          // one allocation for the arrays below
+  double* re;             // current transform, per target
+  double* im;
+  double* omega;
+  double* rot_re;         // e^{i w}
+  double* rot_im;
+  double* out_re;         // e^{i w window}
+  double* out_im;
+} sliding_dft;
+
+sliding_dft* sliding_dft_create(int window, double dc,
+                                int num_targets, double omega[]);
+void sliding_dft_push(sliding_dft* s, int length, double input_signal[]);
+void sliding_dft_power(sliding_dft* s, double power[]);
+void sliding_dft_free(sliding_dft* s);
+
+// Heterodyne and decimate front end.  The input less dc is mixed down by
+// a complex NCO at omega0 (radians per sample, 2 pi f0 / Fs), so f0 lands
+// on 0 Hz, then low pass filtered and decimated by 2 per stage through
+// half-band filters (half their taps are zero).  Outputs first ..
+// first + num - 1 of the complex stream at Fs / 2^stages go to
+// out_re/out_im.  The half-band filters are causal, each delaying by 7
+// samples at its input rate, so output m stands for input sample
+// m 2^stages - 7 (2^stages - 1).  The input needed before first is read
+// from input_signal (zeros before the start), so pieces can be made
+// independently and come out the same as the whole.
+//
+// frontend_stages is how many stages keep f0 +- width / 2 clean at Fs,
+// frontend_length how many outputs num_samples inputs give.
+#define FRONTEND_MAX_STAGES 16
+
+int  frontend_stages(double Fs, double width);
+long frontend_length(long num_samples, int stages);
+int  heterodyne_decimate(long num_samples, double input_signal[], double dc,
+                         double omega0, int stages, long first, long num,
+                         double out_re[], double out_im[]);
+
+// Numerically controlled oscillator for mixing down: the phasor
+// e^{-j omega n} is a table of NCO_BLOCK steps times an exact phasor per
+// block of NCO_BLOCK samples, so there is no recurrence to serialize and
+// sample n's phasor is the same whichever piece it is mixed in.  nco_mix
+// writes samples first .. first + num - 1 of in_re + j in_im, less
+// dc_re + j dc_im, times the phasor, to out_re/out_im (num long).  Sample
+// n is read from in_re[n * stride] and in_im[n * stride]; in_im 0 for
+// real input, e.g. stride 2 and in_im = in_re + 1 for interleaved I/Q.
+#define NCO_BLOCK 1024
+
+typedef struct nco {
+  double omega;
+  double step_re[NCO_BLOCK];
+  double step_im[NCO_BLOCK];
+} nco;
+
+void nco_init(nco* nco, double omega);
+void nco_mix(nco* nco, long first, long num, double in_re[], double in_im[],
+             int stride, double dc_re, double dc_im,
+             double out_re[], double out_im[]);
+
+// Complex (I/Q) input: iq holds I and Q interleaved, mixed as above.
+
+// Power of a complex band pass filter's output: the band around omega is
+// mixed down to 0 Hz and the real low pass coeffs (half the band width)
+// run on each of the mixed I and Q, which is the band pass with taps
+// coeffs[k] e^{j omega k} up to a phase that doesn't change the power.
+// The power kernels do the filtering, a block at a time.
+int convolve_iq_and_compute_power(int length, double iq[], double dc_i, double dc_q,
+                                  double omega, int order, double coeffs[],
+                                  double* power);
+
+// AM demodulation of the carrier filling the band low..high Hz.  The
+// front end mixes the band center down and decimates as far as the band
+// allows (to rate Hz), a low pass of order taps at half the band width
+// selects the channel, and the output is its envelope: the modulation on
+// top of the carrier amplitude, which is left in as DC.  Outputs
+// first .. first + num - 1 are computed straight from the input like
+// heterodyne_decimate's, so a capture can be demodulated in blocks, in
+// any order or in parallel, in bounded memory.
+//
+//   am_demod am;
+//   am_demod_init(&am, Fs, low, high, 64);
+//   long n = am_demod_length(&am, num_samples);
+//   for (long b = 0; b < n; b += block)
+//     am_demodulate(&am, num_samples, data, dc, b, min(block, n - b), out);
+//   am_demod_free(&am);
+typedef struct am_demod {
+  double Fs;            // input rate
+  double carrier;       // Hz
+  double width;         // of the band around it
+  int stages;           // front end decimation by 2^stages
+  double rate;          // output rate
+  int order;            // channel filter
+  double* coeffs;
+} am_demod;
+
+int  am_demod_init(am_demod* am, double Fs, double low, double high, int order);
+void am_demod_free(am_demod* am);
+long am_demod_length(am_demod* am, long num_samples);
+int  am_demodulate(am_demod* am, long num_samples, double input_signal[],
+                   double dc, long first, long num, double output_signal[]);
+
 /* generate an n-order butterworth low-pass filter
  * [b, a] = butter(n, fcf)
  */
@@ -0,0 +1,159 @@
+#include "fir_kernel.h"
+
+/*
+ * Compiled with -DFIR_ISA=<suffix> and the matching -m flags, once per
+ * variant declared in fir_kernel.h.  The code is plain C; the compiler
+ * does the vectorizing for whatever instruction set it is given.
+ */
+
+#ifndef FIR_ISA
+#define FIR_ISA generic
+#endif
+
+#define PASTE(name, isa)  name##_##isa
+#define XPASTE(name, isa) PASTE(name, isa)
+#define KERNEL(name)      XPASTE(name, FIR_ISA)
+
+// Outputs computed together.  The tap loop runs over a block of outputs
+// rather than one output at a time, so the accumulators are independent
+// (no reduction to vectorize) and fill several vector registers, which
+// hides the add latency.  Each output still sums its taps in the same
+// order as the scalar loop.  The squares are summed per lane too, so
+// the power isn't one long dependent chain of adds either.  A block is
+// 8 vector registers for the instruction set, enough accumulators to
+// keep both FMA pipes busy.
+#ifndef FIR_BLOCK
+#define FIR_BLOCK 32
+#endif
+
+// The kernel body.  Inlined with a constant order it becomes one of the
+// specializations below: the tap loop's trip count is a compile-time
+// constant, so it unrolls with no remainder handling.  The coefficients
+// are copied into a small local array; each tap's coefficient is
+// broadcast from there on use, a load that hits L1, since a long filter
+// has far more taps than there are registers.
+static inline __attribute__((always_inline))
+double fir_power_body(int first, int length, double input[],
+                      double offset, int order, double coeffs[]) {
+
+  double c[order + 1];
+  for (int j = 0; j <= order; j++) {
+    c[j] = coeffs[j];
+  }
+
+  double pow_lane[FIR_BLOCK] = {0};
+  int i = first;
+
+  for (; i + FIR_BLOCK <= length; i += FIR_BLOCK) {
+    double acc[FIR_BLOCK] = {0};
+#pragma GCC unroll 8
+    for (int j = order; j >= 0; j--) {
+      double* x = input + i - j;
+      for (int l = 0; l < FIR_BLOCK; l++) {
+        acc[l] += x[l] * c[j];
+      }
+    }
+    for (int l = 0; l < FIR_BLOCK; l++) {
+      double y = acc[l] - offset;
+      pow_lane[l] += y * y;
+    }
+  }
+
+  double pow_sum = 0;
+  for (int l = 0; l < FIR_BLOCK; l++) {
+    pow_sum += pow_lane[l];
+  }
+
+  for (; i < length; i++) {
+    double cur_sum = 0;
+    for (int j = order; j >= 0; j--) {
+      cur_sum += input[i - j] * c[j];
+    }
+    cur_sum -= offset;
+    pow_sum += cur_sum * cur_sum;
+  }
+
+  return pow_sum;
+}
+
+// Specializations for the orders our configurations use
+#define FIR_SPECIALIZE(ORDER)                                            \
+  static double KERNEL(fir_power_##ORDER)(int first, int length,         \
+                                          double input[], double offset, \
+                                          double coeffs[]) {             \
+    return fir_power_body(first, length, input, offset, ORDER, coeffs);  \
+  }
+
+FIR_SPECIALIZE(16)
+FIR_SPECIALIZE(32)
+FIR_SPECIALIZE(64)
+FIR_SPECIALIZE(128)
+FIR_SPECIALIZE(256)
+
+double KERNEL(fir_power)(int first, int length, double input[],
+                         double offset, int order, double coeffs[]) {
+
+  switch (order) {
+    case 16:
+      return KERNEL(fir_power_16)(first, length, input, offset, coeffs);
+    case 32:
+      return KERNEL(fir_power_32)(first, length, input, offset, coeffs);
+    case 64:
+      return KERNEL(fir_power_64)(first, length, input, offset, coeffs);
+    case 128:
+      return KERNEL(fir_power_128)(first, length, input, offset, coeffs);
+    case 256:
+      return KERNEL(fir_power_256)(first, length, input, offset, coeffs);
+    default:
+      return fir_power_body(first, length, input, offset, order, coeffs);
+  }
+}
+
+// IIR bank lanes: bands run together, 4 vector registers' worth, so the
+// recursions of different bands hide each other's latency
+#define IIR_LANES (FIR_BLOCK / 2)
+
+void KERNEL(iir_power)(int first, int length, double input[],
+                       int num_bands, double coeffs[], double state[],
+                       double power[]) {
+
+  for (int b = 0; b < num_bands; b += IIR_LANES) {
+    double a1[IIR_LANES], a2[IIR_LANES], c1[IIR_LANES], c2[IIR_LANES];
+    double y1[IIR_LANES], y2[IIR_LANES], z1[IIR_LANES], z2[IIR_LANES];
+    double pw[IIR_LANES];
+    for (int l = 0; l < IIR_LANES; l++) {
+      a1[l] = coeffs[b + l];
+      a2[l] = coeffs[num_bands + b + l];
+      c1[l] = coeffs[2 * num_bands + b + l];
+      c2[l] = coeffs[3 * num_bands + b + l];
+      y1[l] = state[b + l];
+      y2[l] = state[num_bands + b + l];
+      z1[l] = state[2 * num_bands + b + l];
+      z2[l] = state[3 * num_bands + b + l];
+      pw[l] = 0;
+    }
+
+    for (int i = first; i < length; i++) {
+      // both sections have their zeros at DC and Nyquist, 1 - z^-2, so
+      // the input difference is shared by every band (and has no DC)
+      double v = input[i] - input[i - 2];
+      for (int l = 0; l < IIR_LANES; l++) {
+        double y = v - a1[l] * y1[l] - a2[l] * y2[l];
+        double z = (y - y2[l]) - c1[l] * z1[l] - c2[l] * z2[l];
+        y2[l] = y1[l];
+        y1[l] = y;
+        z2[l] = z1[l];
+        z1[l] = z;
+        pw[l] += z * z;
+      }
+    }
+
+    for (int l = 0; l < IIR_LANES; l++) {
+      state[b + l] = y1[l];
+      state[num_bands + b + l] = y2[l];
+      state[2 * num_bands + b + l] = z1[l];
+      state[3 * num_bands + b + l] = z2[l];
+      power[b + l] += pw[l];
+    }
+  }
+}
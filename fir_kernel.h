@@ -0,0 +1,58 @@
+#ifndef _fir_kernel
+#define _fir_kernel
+
+/*
+ *  FIR filter inner kernels, internal to libfilter
+ *
+ *  fir_kernel.c is compiled once per instruction set (see the Makefile),
+ *  each copy getting its own suffix, and filter.c picks the best one the
+ *  CPU supports at startup.  So libfilter.a runs anywhere x86-64 does and
+ *  still uses AVX2/AVX-512 where they are available.
+ *
+ *  fir_power returns sum over i in [first, length) of
+ *
+ *     (sum_{j=0..order} input[i - j] * coeffs[j] - offset)^2
+ *
+ *  with first >= order, so every tap has input.
+ */
+
+typedef double (*fir_power_kernel)(int first, int length, double input[],
+                                   double offset, int order, double coeffs[]);
+
+double fir_power_generic(int first, int length, double input[],
+                         double offset, int order, double coeffs[]);
+double fir_power_sse42(int first, int length, double input[],
+                       double offset, int order, double coeffs[]);
+double fir_power_avx2(int first, int length, double input[],
+                      double offset, int order, double coeffs[]);
+double fir_power_avx512(int first, int length, double input[],
+                        double offset, int order, double coeffs[]);
+
+/*
+ *  IIR resonator bank kernel: num_bands bands (a multiple of
+ *  IIR_MAX_LANES), each two biquads with numerators 1 - z^-2,
+ *
+ *     y[i] = (x[i] - x[i - 2]) - a1 y[i - 1] - a2 y[i - 2]
+ *     z[i] = (y[i] - y[i - 2]) - c1 z[i - 1] - c2 z[i - 2]
+ *
+ *  for i in [first, length), first >= 2.  coeffs holds a1, a2, c1, c2 for
+ *  every band, each as an array of num_bands; state likewise holds
+ *  y[i - 1], y[i - 2], z[i - 1], z[i - 2] and is carried from call to call.
+ *  power[b] is increased by the sum of z^2 for band b.
+ */
+#define IIR_MAX_LANES 32
+
+typedef void (*iir_power_kernel)(int first, int length, double input[],
+                                 int num_bands, double coeffs[], double state[],
+                                 double power[]);
+
+void iir_power_generic(int first, int length, double input[], int num_bands,
+                       double coeffs[], double state[], double power[]);
+void iir_power_sse42(int first, int length, double input[], int num_bands,
+                     double coeffs[], double state[], double power[]);
+void iir_power_avx2(int first, int length, double input[], int num_bands,
+                    double coeffs[], double state[], double power[]);
+void iir_power_avx512(int first, int length, double input[], int num_bands,
+                      double coeffs[], double state[], double power[]);
+
+#endif
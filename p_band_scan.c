@@ -7,16 +7,16 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <ctype.h>
+#include <string.h>
 #include <assert.h>
 
 #include "filter.h"
 #include "signal.h"
 #include "timing.h"
-
-#define MAXWIDTH 40
-#define THRESHOLD 2.0
-#define ALIENS_LOW  50000.0
-#define ALIENS_HIGH 150000.0
+#include "report.h"
+#include "scan.h"
+#include "arena.h"
+#include "fft.h"
 
 int num_threads;
 int num_processors;
@@ -26,28 +26,61 @@ int vector_len;       // length of vector we will sum
 double* vector;       // the vector we will sum
 
 
-typedef struct inputs{
-  int id;
-  double bandwidth;
-  int filterOrder;
-  double* filterCoeffs;
-  signal* sig;
-  double* band_power;
-  int num_band;
-} inputs;
+int detect_only = 0;  // -d: only filter the bands the WOW decision needs
+int refine_bands = 0; // -r: refine hits down to this many bands
+int refine_order = 256; //     using filters of at most this order
+report_format out_format = REPORT_TEXT; // -f: structured results as well
+char* out_path = 0;     // -o: where they go (stdout if not given)
+int out_fd = -1;
+int arena_flags = 0;    // -H: huge pages for the run arena
+scan_engine engine = SCAN_DIRECT; // -e: how bands are filtered
+int use_welch = 0;      // -e welch: estimate band powers from the PSD
+int front_end = 0;      // -F: scan the alien window at baseband
+char* wisdom_path = 0;  // -W: FFTW wisdom file, loaded and saved
+char* demod_path = 0;   // -A: AM demodulate the hit into this file
+#define DEMOD_ORDER 64  //     with a channel filter of this order
+char* wav_path = 0;     // -a: and/or as audio
+int wav_rate = 8000;    //     at this rate
+filter_spec design = {DESIGN_HAMMING, 0, 0}; // -D: filters by specification
+int use_design = 0;
+int prescreen = 0;      // -P: bound bands from the spectrum, filter few
+int sample_stride = 0;  // -S: estimate bands from one output in this many
+int iq = 0;             // -q: the file holds I/Q pairs
 
 void usage() {
-  printf("usage: band_scan text|bin|mmap signal_file Fs filter_order num_bands\n");
-}
-
-double avg_power(double* data, int num) {
-
-  double ss = 0;
-  for (int i = 0; i < num; i++) {
-    ss += data[i] * data[i];
-  }
-
-  return ss / num;
+  printf("usage: p_band_scan [-d] [-F] [-P] [-S stride] [-q] [-r bands[:order]] [-f text|json|csv|bin] [-o file] [-H] [-e direct|fft|welch|iir] [-W wisdom_file] [-A demod_file] [-a wav_file[:rate]] [-D hamming|kaiser|remez[:atten[:transition]]] text|bin|mmap signal_file Fs filter_order num_bands num_threads num_processors\n"
+         "  -d  detection mode: filter only the bands in the alien window and\n"
+         "      bound the average band power from the total signal power\n"
+         "  -F  like -d, but mix the alien window down to baseband and decimate\n"
+         "      it first, and filter its bands at the reduced rate\n"
+         "  -P  pre-screen: bound every band's power from one FFT of the signal\n"
+         "      and filter only the window bands and what the verdict needs\n"
+         "  -S  estimate band powers from one filter output in stride, with\n"
+         "      confidence intervals, and filter exactly only where they leave\n"
+         "      a verdict open (probable, not guaranteed, verdicts; not with\n"
+         "      -e iir)\n"
+         "  -q  the file is a complex capture, I and Q interleaved: scan\n"
+         "      -Fs/2..Fs/2 (full scan, direct or FFT engine, no -D, -r, -A, -a)\n"
+         "  -r  after the scan, split each WOW band in half (doubling the filter\n"
+         "      order, up to order) until it is as narrow as a bands-band scan\n"
+         "      (bands must be num_bands times a power of 2)\n"
+         "  -f  also write machine readable results (see report.h)\n"
+         "  -o  write them to file instead of stdout (else text goes to stderr)\n"
+         "  -H  back the run's memory with huge pages if the system allows\n"
+         "  -e  filter by direct convolution (default) or FFT overlap-save, or\n"
+         "      estimate all band powers at once from a Welch PSD (no filters;\n"
+         "      refinement still filters by direct convolution), or run every\n"
+         "      band through a 4th order IIR band pass in one pass (cheapest,\n"
+         "      least selective; filter_order and -D are ignored)\n"
+         "  -d/-F, -P, -S and -e welch are alternatives, at most one of them;\n"
+         "  -e iir runs a full scan only\n"
+         "  -W  FFTW wisdom file, read at startup if present and updated at exit\n"
+         "  -A  AM demodulate the band found (after -r) into this file, as\n"
+         "      binary doubles at the decimated rate\n"
+         "  -a  same, as 16-bit WAV audio at rate (default 8000) Hz\n"
+         "  -D  design the filters for atten dB (default 60) with this transition\n"
+         "      width in Hz (default one band), at the smallest order that meets\n"
+         "      it; filter_order is then ignored\n");
 }
 
 double max_of(double* data, int num) {
@@ -70,53 +103,249 @@ double avg_of(double* data, int num) {
   return s / num;
 }
 
-void remove_dc(double* data, int num) {
+/*
+ * Detection mode.  Only the bands overlapping the alien window can be
+ * flagged, but the flag compares them against THRESHOLD times the average
+ * power of ALL bands.  Instead of filtering every band to get that average,
+ * bound it:
+ *
+ *   sum_b power_b <= max_f G(f) * E / N
+ *   sum_b power_b >= (min_f G(f) * E - max_f G(f) * E_tail) / N
+ *
+ * where G(f) = sum_b |H_b(f)|^2 is the summed gain of the filter bank, E is
+ * the signal energy (Parseval), and E_tail is the energy of the last
+ * `order` samples, which bounds what the truncated convolution drops.  A
+ * window band is decided if it is above THRESHOLD times the upper bound
+ * (WOW) or not above THRESHOLD times the lower bound (meh).  If any band is
+ * left undecided we fall back to filtering everything, so the verdict is
+ * always the same as a full scan.
+ *
+ * Returns 1 and fills in the average band power to compare against if
+ * every window band was decided, 0 if the caller must scan the rest.
+ */
+int bound_avg_band_power(signal* sig, signal_stats* stats,
+                         int filter_order, int num_bands,
+                         double bandwidth, double* band_power,
+                         int* window, int num_window, double* avg_band_power) {
+
+  double* bank = run_alloc(num_bands * (filter_order + 1) * sizeof(double));
+  for (int band = 0; band < num_bands; band++) {
+    double* c = bank + band * (filter_order + 1);
+    design_band_pass(&design,
+                     sig->Fs,
+                     BAND_LOW(band, bandwidth),
+                     BAND_HIGH(band, bandwidth),
+                     filter_order,
+                     c);
+  }
+
+  double gmin, gmax;
+  power_gain_bounds(filter_order, num_bands, bank, &gmin, &gmax);
+  run_free(bank);
+
+  int N = sig->num_samples;
+  double energy = stats->power * N;
+  int tail = filter_order < N ? filter_order : N;
+  double tail_energy = 0;
+  for (int i = N - tail; i < N; i++) {
+    double x = sig->data[i] - stats->mean;
+    tail_energy += x * x;
+  }
 
-  double dc = avg_of(data,num);
+  double window_sum = 0;
+  for (int k = 0; k < num_window; k++) {
+    window_sum += band_power[window[k]];
+  }
 
-  printf("Removing DC component of %lf\n",dc);
+  double hi = gmax * energy / N;
+  double lo = fmax(window_sum, (gmin * energy - gmax * tail_energy) / N);
+  double avg_hi = hi / num_bands;
+  double avg_lo = lo / num_bands;
 
-  for (int i = 0; i < num; i++) {
-    data[i] -= dc;
+  printf("average band power bounded to [%lf, %lf] (gain %lf..%lf)\n",
+         avg_lo, avg_hi, gmin, gmax);
+
+  for (int k = 0; k < num_window; k++) {
+    double p = band_power[window[k]];
+    if (p <= THRESHOLD * avg_hi && p > THRESHOLD * avg_lo) {
+      printf("band %d is too close to the threshold to decide from bounds\n", window[k]);
+      return 0;
+    }
   }
+
+  // every window band is either above THRESHOLD * avg_hi or at most
+  // THRESHOLD * avg_lo, so comparing against avg_hi classifies them exactly
+  *avg_band_power = avg_hi;
+  return 1;
 }
 
+/*
+ * Verdicts from bounds.  Given lower[b] <= power of band b <= upper[b]
+ * (equal once a band is filtered) and band_power[b] somewhere between,
+ * a window band is decided as in detection mode: WOW if above THRESHOLD
+ * times the largest average the bounds allow, meh if not above THRESHOLD
+ * times the smallest.  While one is not, filter exactly the undecided
+ * window bands, or if they all are exact, the bands with the widest
+ * bounds, twice as many each round.  Every band's band_power then falls
+ * on the same side of THRESHOLD times the returned average as its exact
+ * power would.  Returns the number of bands filtered.
+ */
+static double* settle_width;
+
+static int by_width(const void* a, const void* b) {
+  double wa = settle_width[*(int*)a];
+  double wb = settle_width[*(int*)b];
+  return wa < wb ? 1 : (wa > wb ? -1 : 0);
+}
 
-void* worker(void* arg) {
-  //int blocksize = vector_len / num_threads; // note: floor
-  inputs *input = (inputs*)arg;
-  int myid = input->id;
-  //printf("myid: %d\n", myid);
-  
+int settle_bands(signal* sig, double dc, int filter_order, int num_bands,
+                 double bandwidth, double* lower, double* upper,
+                 double* band_power, double* avg_band_power) {
+
+  int* scan = run_alloc(num_bands * sizeof(int));
+  settle_width = run_alloc(num_bands * sizeof(double));
+  int filtered = 0;
+  int batch = num_threads;
+
+  for (;;) {
+    double lo = 0;
+    double hi = 0;
+    for (int band = 0; band < num_bands; band++) {
+      lo += lower[band];
+      hi += upper[band];
+    }
+    *avg_band_power = hi / num_bands;
+
+    int num_scan = 0;
+    int decided = 1;
+    for (int band = 0; band < num_bands; band++) {
+      if (in_alien_window(BAND_LOW(band, bandwidth), BAND_HIGH(band, bandwidth)) &&
+          !(lower[band] > THRESHOLD * hi / num_bands) &&
+          !(upper[band] <= THRESHOLD * lo / num_bands)) {
+        decided = 0;
+        if (upper[band] > lower[band]) {
+          scan[num_scan++] = band;
+        }
+      }
+    }
+    if (decided) {
+      printf("settled after filtering %d more bands, average band power in [%lf, %lf]\n",
+             filtered, lo / num_bands, hi / num_bands);
+      break;
+    }
 
-  // put ourselves on the desired processor
-  cpu_set_t set;
-  CPU_ZERO(&set);
-  CPU_SET(myid % num_processors, &set);
-  if (sched_setaffinity(0, sizeof(set), &set) < 0) { // do it
-    perror("Can't setaffinity"); // hopefully doesn't fail
-    exit(-1);
-  }
-
-  if(myid <= input->num_band - 1){
-    generate_band_pass(input->sig->Fs,
-                        myid * input->bandwidth + 0.0001, // keep within limits
-                        (myid + 1) * input->bandwidth - 0.0001,
-                        input->filterOrder,
-                        input->filterCoeffs);
-    hamming_window(input->filterOrder,input->filterCoeffs);
-  
-  
-    convolve_and_compute_power(input->sig->num_samples,
-                              input->sig->data,
-                              input->filterOrder,
-                              input->filterCoeffs,
-                              &(input->band_power[myid]));
-  }
-  free(input->filterCoeffs); 
-  free(input); // prevent memory leak
-  // Done.  The master thread will sum up the partial sums
-  pthread_exit(NULL);           // finish - no return value
+    if (num_scan == 0) {
+      // the window bands are exact: narrow the average
+      for (int band = 0; band < num_bands; band++) {
+        if (upper[band] > lower[band]) {
+          scan[num_scan++] = band;
+        }
+      }
+      if (num_scan == 0) {
+        break;          // all exact; the average is too
+      }
+      for (int band = 0; band < num_bands; band++) {
+        settle_width[band] = upper[band] - lower[band];
+      }
+      qsort(scan, num_scan, sizeof(int), by_width);
+      num_scan = num_scan < batch ? num_scan : batch;
+      batch *= 2;
+    }
+
+    scan_bands(sig, dc, filter_order, bandwidth, band_power, scan, num_scan,
+               num_threads, 0, num_processors);
+    filtered += num_scan;
+    for (int k = 0; k < num_scan; k++) {
+      lower[scan[k]] = upper[scan[k]] = band_power[scan[k]];
+    }
+  }
+
+  run_free(settle_width);
+  run_free(scan);
+  return filtered;
+}
+
+/*
+ * Pre-screen mode.  scan_prescreen bounds every band's power without
+ * filtering it.  The window bands are filtered exactly, since they are
+ * the ones reported; the rest keep their bounds unless settle_bands
+ * needs them, and get the middle of their bounds.
+ *
+ * Returns 0 and the average band power to compare against, or -1 if
+ * there is nothing to pre-screen.
+ */
+int prescreen_bands(signal* sig, double dc, int filter_order, int num_bands,
+                    double bandwidth, double* band_power, double* avg_band_power) {
+
+  double* lower = run_alloc(num_bands * sizeof(double));
+  double* upper = run_alloc(num_bands * sizeof(double));
+  int* window = run_alloc(num_bands * sizeof(int));
+
+  if (scan_prescreen(sig, dc, filter_order, bandwidth, num_bands, lower, upper,
+                     num_threads, 0, num_processors)) {
+    run_free(window);
+    run_free(upper);
+    run_free(lower);
+    return -1;
+  }
+
+  int num_window = 0;
+  for (int band = 0; band < num_bands; band++) {
+    band_power[band] = (lower[band] + upper[band]) / 2;
+    if (in_alien_window(BAND_LOW(band, bandwidth), BAND_HIGH(band, bandwidth))) {
+      window[num_window++] = band;
+    }
+  }
+  scan_bands(sig, dc, filter_order, bandwidth, band_power, window, num_window,
+             num_threads, 0, num_processors);
+  for (int k = 0; k < num_window; k++) {
+    lower[window[k]] = upper[window[k]] = band_power[window[k]];
+  }
+
+  printf("pre-screen: bounded %d bands, filtered the %d window bands\n", num_bands, num_window);
+  settle_bands(sig, dc, filter_order, num_bands, bandwidth, lower, upper,
+               band_power, avg_band_power);
+
+  run_free(window);
+  run_free(upper);
+  run_free(lower);
+  return 0;
+}
+
+/*
+ * Sampled mode.  scan_estimate gives every band's power from one filter
+ * output in sample_stride, with a confidence interval, and settle_bands
+ * filters exactly only where the interval leaves a verdict open, so the
+ * cost is about 1 / sample_stride of a full scan away from the threshold.
+ * The intervals are statistical, not guaranteed (see
+ * convolve_dc_and_estimate_power): a decided band is right with high
+ * probability, not certainty.
+ */
+void sample_bands(signal* sig, double dc, int filter_order, int num_bands,
+                  double bandwidth, double* band_power, double* avg_band_power) {
+
+  double* lower = run_alloc(num_bands * sizeof(double));
+  double* upper = run_alloc(num_bands * sizeof(double));
+  int* bands = run_alloc(num_bands * sizeof(int));
+
+  for (int band = 0; band < num_bands; band++) {
+    bands[band] = band;
+  }
+  scan_estimate(sig, dc, filter_order, bandwidth, sample_stride, band_power, upper,
+                bands, num_bands, num_threads, 0, num_processors);
+  for (int band = 0; band < num_bands; band++) {
+    double error = upper[band];
+    lower[band] = fmax(0.0, band_power[band] - error);
+    upper[band] = band_power[band] + error;
+  }
+
+  printf("sampled: %d bands from 1 output in %d\n", num_bands, sample_stride);
+  settle_bands(sig, dc, filter_order, num_bands, bandwidth, lower, upper,
+               band_power, avg_band_power);
+
+  run_free(bands);
+  run_free(upper);
+  run_free(lower);
 }
 
 unsigned long long int rdtsc(void) {
@@ -130,6 +359,174 @@ unsigned long long int rdtsc(void) {
   return ((unsigned long long)a) | (((unsigned long long)d) << 32);
 }
 
+/*
+ * Coarse-to-fine refinement.  Starting from the WOW bands of the coarse
+ * scan, split every candidate band in two, doubling the filter order
+ * (up to refine_order) to keep the same selectivity relative to the band,
+ * and keep the halves that are still above THRESHOLD times the average
+ * band power at that resolution.  If neither half of a candidate is above
+ * it but together they still are (a carrier sitting on the split), the
+ * stronger half survives.  Stops
+ * at refine_bands resolution.  Only the candidates are ever filtered, so
+ * the cost grows with the number of hits rather than with refine_bands.
+ *
+ * Returns 1 and the final edges in lb/ub if any candidate survives.
+ */
+int refine_hits(signal* sig, double dc, int filter_order, int num_bands,
+                double avg_band_power, double* band_power,
+                double* lb, double* ub) {
+
+  double Fc = (sig->Fs) / 2;
+  double start = get_seconds();
+
+  int* hits  = run_alloc(refine_bands * sizeof(int));
+  int* scan  = run_alloc(refine_bands * sizeof(int));
+  double* power = run_alloc(refine_bands * sizeof(double));
+  int num_hits = 0;
+
+  for (int band = 0; band < num_bands; band++) {
+    double bandwidth = Fc / num_bands;
+    if (in_alien_window(BAND_LOW(band, bandwidth), BAND_HIGH(band, bandwidth)) &&
+        band_power[band] > THRESHOLD * avg_band_power) {
+      hits[num_hits++] = band;
+      power[band] = band_power[band];
+    }
+  }
+
+  int cur_bands = num_bands;
+  int cur_order = filter_order;
+  double taps = (double)num_bands * (filter_order + 1);
+
+  while (num_hits > 0 && cur_bands * 2 <= refine_bands) {
+    cur_bands *= 2;
+    cur_order = cur_order * 2 < refine_order ? cur_order * 2 : refine_order;
+    // a designed filter keeps its transition in step with its order
+    filter_spec level = design;
+    level.transition = design.transition * filter_order / cur_order;
+    scan_use_design(&level);
+
+    double bandwidth = Fc / cur_bands;
+    // the total is spread over twice as many bands at each level
+    double avg = avg_band_power * num_bands / cur_bands;
+
+    int num_scan = 0;
+    for (int h = 0; h < num_hits; h++) {
+      scan[num_scan++] = 2 * hits[h];
+      scan[num_scan++] = 2 * hits[h] + 1;
+    }
+
+    scan_bands(sig, dc, cur_order, bandwidth, power, scan, num_scan,
+               num_threads, 0, num_processors);
+    taps += (double)num_scan * (cur_order + 1);
+
+    num_hits = 0;
+    for (int k = 0; k < num_scan; k += 2) {
+      int keep = -1;
+      for (int half = k; half < k + 2; half++) {
+        int band = scan[half];
+        if (in_alien_window(BAND_LOW(band, bandwidth), BAND_HIGH(band, bandwidth))) {
+          if (power[band] > THRESHOLD * avg) {
+            hits[num_hits++] = band;
+            keep = -2;
+          } else if (keep == -1 || (keep >= 0 && power[band] > power[keep])) {
+            keep = band;
+          }
+        }
+      }
+      // the parent's power is still there, just split across the halves
+      if (keep >= 0 && power[scan[k]] + power[scan[k + 1]] > 2 * THRESHOLD * avg) {
+        hits[num_hits++] = keep;
+      }
+    }
+
+    printf("refine: %5d bands, order %4d, %4d filtered, %4d candidates\n",
+           cur_bands, cur_order, num_scan, num_hits);
+  }
+  scan_use_design(&design);
+
+  double bandwidth = Fc / cur_bands;
+  *lb = -1;
+  *ub = -1;
+  for (int h = 0; h < num_hits; h++) {
+    double band_low  = BAND_LOW(hits[h], bandwidth);
+    double band_high = BAND_HIGH(hits[h], bandwidth);
+    printf("refined %5d %20lf to %20lf Hz: %20lf (CENTER %lf HZ)\n",
+           hits[h], band_low, band_high, power[hits[h]], (band_low + band_high) / 2.0);
+    if (*lb < 0 || band_low < *lb) {
+      *lb = band_low;
+    }
+    if (band_high > *ub) {
+      *ub = band_high;
+    }
+  }
+
+  double uniform = (double)cur_bands * (cur_order + 1);
+  printf("Refinement to %d bands filtered %.0f band-taps, %.1f%% of a uniform %d-band order %d scan\n",
+         cur_bands, taps, 100.0 * taps / uniform, cur_bands, cur_order);
+  printf("Refinement took %lf seconds by basic timing\n", get_seconds_diff(start));
+
+  run_free(hits);
+  run_free(scan);
+  run_free(power);
+
+  return num_hits > 0;
+}
+
+/*
+ * Front end for detection mode: the window bands span low..high, so mix
+ * its center to 0 Hz and decimate as far as that span allows, and filter
+ * them there.
+ */
+void scan_window_baseband(signal* sig, double dc, int filter_order, double bandwidth,
+                          double* band_power, int* window, int num_window) {
+
+  double low  = BAND_LOW(window[0], bandwidth);
+  double high = BAND_HIGH(window[num_window - 1], bandwidth);
+  int stages = frontend_stages(sig->Fs, high - low);
+
+  printf("front end: %lf Hz +- %lf Hz, decimated by %d\n",
+         (low + high) / 2, (high - low) / 2, 1 << stages);
+
+  scan_baseband(sig, dc, (low + high) / 2, stages, filter_order, bandwidth,
+                band_power, window, num_window, num_threads, 0, num_processors);
+}
+
+/*
+ * Demodulate the hit: the carrier is somewhere in low..high, so take the
+ * envelope of that band, at the lowest rate that band allows
+ */
+int demodulate_hit(signal* sig, double dc, double low, double high) {
+
+  double start = get_seconds();
+
+  am_demod am;
+  if (am_demod_init(&am, sig->Fs, low, high, DEMOD_ORDER)) {
+    perror("Not enough memory");
+    return -1;
+  }
+
+  signal* out = allocate_signal(am_demod_length(&am, sig->num_samples), am.rate, 0);
+  if (!out) {
+    am_demod_free(&am);
+    return -1;
+  }
+  scan_demodulate(sig, dc, &am, out->data, num_threads, 0, num_processors);
+
+  printf("Demodulated %lf-%lf HZ at %lf Hz (decimated by %d) in %lf seconds\n",
+         low, high, am.rate, 1 << am.stages, get_seconds_diff(start));
+  int rc = 0;
+  if (demod_path) {
+    rc |= save_binary_format_signal(demod_path, out);
+  }
+  if (wav_path) {
+    rc |= save_wav_format_signal(wav_path, out, wav_rate);
+  }
+
+  free_signal(out);
+  am_demod_free(&am);
+  return rc;
+}
+
 /*
 1. remove the dc component from each data point
 2. find the average signal power
@@ -146,11 +543,28 @@ unsigned long long int rdtsc(void) {
 int analyze_signal(signal* sig, int filter_order, int num_bands, double* lb, double* ub) {
 
   double Fc        = (sig->Fs) / 2;
-  double bandwidth = Fc / num_bands;
+  double bandwidth = sig->iq ? 2 * Fc / num_bands : Fc / num_bands;
+
+  // one parallel pass for DC and power; the DC is subtracted on the fly
+  // by the filters, so the signal is never rewritten
+  signal_stats stats;
+  signal_stats q_stats;
+  double dc_q = 0;
+  if (sig->iq) {
+    scan_iq_statistics(sig, &stats, &q_stats, num_threads, 0, num_processors);
+    dc_q = q_stats.mean;
+  } else {
+    scan_statistics(sig, &stats, num_threads, 0, num_processors);
+  }
+  double dc = stats.mean;
 
-  remove_dc(sig->data,sig->num_samples);
+  if (sig->iq) {
+    printf("Removing DC component of %lf + %lf j\n", dc, dc_q);
+  } else {
+    printf("Removing DC component of %lf\n", dc);
+  }
 
-  double signal_power = avg_power(sig->data,sig->num_samples);
+  double signal_power = sig->iq ? stats.power + q_stats.power : stats.power;
 
   printf("signal average power:     %lf\n", signal_power);
 
@@ -160,47 +574,70 @@ int analyze_signal(signal* sig, int filter_order, int num_bands, double* lb, dou
   unsigned long long tstart = get_cycle_count();
 
   
-  double* band_power = malloc(num_bands * sizeof(double));
+  double* band_power = run_alloc(num_bands * sizeof(double));
   for(int band_index = 0; band_index < num_bands; band_index++){
     band_power[band_index] = -1;
   }
-  
-  //unsigned long long start = rdtsc();
-  double hold_num_bands = (double)num_bands;
-  double hold_num_threads = (double)num_threads;
-  pthread_t* tid = malloc(num_threads * sizeof(pthread_t));             // array of thread ids
-  for (int group = 0; group < ceil(hold_num_bands/hold_num_threads); group++) {
-    for (long i = 0; i < num_threads; i++) {
-      inputs* thread_inputs = malloc(sizeof(inputs));
-      thread_inputs -> id = (group * num_threads)+i;
-      thread_inputs->bandwidth = bandwidth;
-      thread_inputs->filterOrder = filter_order;
-      thread_inputs->filterCoeffs = malloc((filter_order+1)*sizeof(double));
-      thread_inputs->sig = sig;
-      thread_inputs->band_power = band_power;
-      thread_inputs->num_band = num_bands;
-      int returncode = pthread_create(&(tid[i]),  // thread id gets put here
-                                      NULL, // use default attributes
-                                      worker, // thread will begin in this function
-                                      (void*)thread_inputs 
-                                      );
-      if (returncode != 0) {
-        perror("Failed to start thread");
-        exit(-1);
+
+  int* bands = run_alloc(num_bands * sizeof(int));
+  int num_scan = 0;
+  int scanned_all = 1;
+  double avg_band_power = 0;
+
+  if (sig->iq) {
+    for (int band = 0; band < num_bands; band++) {
+      bands[num_scan++] = band;
+    }
+    scan_bands_iq(sig, dc, dc_q, filter_order, bandwidth, band_power, bands, num_scan,
+                  num_threads, 0, num_processors);
+  } else if (use_welch && !scan_welch(sig, dc, num_bands, bandwidth, band_power,
+                               num_threads, 0, num_processors)) {
+    printf("Welch PSD: %d sample segments\n", welch_segment(num_bands));
+  } else if (prescreen &&
+             prescreen_bands(sig, dc, filter_order, num_bands, bandwidth,
+                             band_power, &avg_band_power) >= 0) {
+    scanned_all = 0;
+  } else if (sample_stride > 0) {
+    sample_bands(sig, dc, filter_order, num_bands, bandwidth, band_power, &avg_band_power);
+    scanned_all = 0;
+  } else if (detect_only) {
+    for (int band = 0; band < num_bands; band++) {
+      if (in_alien_window(BAND_LOW(band, bandwidth), BAND_HIGH(band, bandwidth))) {
+        bands[num_scan++] = band;
       }
     }
+    if (front_end) {
+      scan_window_baseband(sig, dc, filter_order, bandwidth, band_power, bands, num_scan);
+    } else {
+      scan_bands(sig, dc, filter_order, bandwidth, band_power, bands, num_scan,
+                 num_threads, 0, num_processors);
+    }
 
-    // now we will join all the threads
-    for (int i = 0; i < num_threads; i++) {
-      int returncode = pthread_join(tid[i], NULL);
-      if (returncode != 0) {
-        perror("join failed");
-        exit(-1);
+    if (bound_avg_band_power(sig, &stats, filter_order, num_bands, bandwidth,
+                             band_power, bands, num_scan, &avg_band_power)) {
+      scanned_all = 0;
+      printf("detection mode: filtered %d of %d bands\n", num_scan, num_bands);
+    } else {
+      // scan what is left and decide exactly
+      int num_rest = 0;
+      for (int band = 0; band < num_bands; band++) {
+        if (band_power[band] < 0) {
+          bands[num_rest++] = band;
+        }
       }
+      scan_bands(sig, dc, filter_order, bandwidth, band_power, bands, num_rest,
+               num_threads, 0, num_processors);
     }
-
+  } else {
+    for (int band = 0; band < num_bands; band++) {
+      bands[num_scan++] = band;
+    }
+    scan_bands(sig, dc, filter_order, bandwidth, band_power, bands, num_scan,
+               num_threads, 0, num_processors);
   }
 
+  run_free(bands);
+
   unsigned long long tend = get_cycle_count();
   double time_end = get_seconds();
 
@@ -211,72 +648,132 @@ int analyze_signal(signal* sig, int filter_order, int num_bands, double* lb, dou
   get_resources_diff(&rstart, &rend, &rdiff);
 
   // Pretty print results
-  double max_band_power = max_of(band_power,num_bands);
-  double avg_band_power = avg_of(band_power,num_bands);
-  int wow = 0;
-  *lb = -1;
-  *ub = -1;
-
-  for (int band = 0; band < num_bands; band++) {
-    double band_low  = band * bandwidth + 0.0001;
-    double band_high = (band + 1) * bandwidth - 0.0001;
-
-    printf("%5d %20lf to %20lf Hz: %20lf ",
-           band, band_low, band_high, band_power[band]);
-
-    for (int i = 0; i < MAXWIDTH * (band_power[band] / max_band_power); i++) {
-      printf("*");
-    }
-
-    if ((band_low >= ALIENS_LOW && band_low <= ALIENS_HIGH) ||
-        (band_high >= ALIENS_LOW && band_high <= ALIENS_HIGH)) {
-
-      // band of interest
-      if (band_power[band] > THRESHOLD * avg_band_power) {
-        printf("(WOW)");
-        wow = 1;
-        if (*lb < 0) {
-          *lb = band * bandwidth + 0.0001;
-        }
-        *ub = (band + 1) * bandwidth - 0.0001;
-      } else {
-        printf("(meh)");
-      }
-    } else {
-      printf("(meh)");
-    }
+  if (scanned_all) {
+    avg_band_power = avg_of(band_power,num_bands);
+  }
+  int wow = report_bands(num_bands, bandwidth, band_power, avg_band_power, lb, ub);
 
-    printf("\n");
-  }
-
-  printf("Resource usages:\n\
-User time        %lf seconds\n\
-System time      %lf seconds\n\
-Page faults      %ld\n\
-Page swaps       %ld\n\
-Blocks of I/O    %ld\n\
-Signals caught   %ld\n\
-Context switches %ld\n",
-         rdiff.usertime,
-         rdiff.systime,
-         rdiff.pagefaults,
-         rdiff.pageswaps,
-         rdiff.ioblocks,
-         rdiff.sigs,
-         rdiff.contextswitches);
+  report_resources(&rdiff);
 
   printf("Analysis took %llu cycles (%lf seconds) by cycle count, timing overhead=%llu cycles\n"
          "Note that cycle count only makes sense if the thread stayed on one core\n",
          tend - tstart, cycles_to_seconds(tend - tstart), timing_overhead());
   printf("Analysis took %lf seconds by basic timing\n", time_end - time_start);
 
-  free(tid);
-  free(band_power);
+  if (wow && refine_bands > num_bands) {
+    wow = refine_hits(sig, dc, filter_order, num_bands, avg_band_power, band_power, lb, ub);
+  }
+
+  if (wow && (demod_path || wav_path)) {
+    demodulate_hit(sig, dc, *lb, *ub);
+  }
+
+  if (out_format != REPORT_TEXT) {
+    report_record r = {.num_bands = num_bands, .filter_order = filter_order,
+                       .num_samples = sig->num_samples, .wow = wow,
+                       .Fs = sig->Fs, .bandwidth = bandwidth,
+                       .signal_power = signal_power, .avg_band_power = avg_band_power,
+                       .lb = *lb, .ub = *ub, .seconds = time_end - time_start,
+                       .cycles = tend - tstart, .rusage = rdiff};
+    report_structured(out_fd, out_format, &r, band_power);
+  }
+
+  run_free(band_power);
   return wow;
 }
 
 int main(int argc, char* argv[]) {
 
+  int opt;
+  while ((opt = getopt(argc, argv, "dFPqS:r:f:o:He:W:A:a:D:h")) != -1) {
+    switch (opt) {
+      case 'd':
+        detect_only = 1;
+        break;
+      case 'F':
+        detect_only = 1;
+        front_end = 1;
+        break;
+      case 'P':
+        prescreen = 1;
+        break;
+      case 'q':
+        iq = 1;
+        break;
+      case 'S':
+        sample_stride = atoi(optarg);
+        if (sample_stride <= 0) {
+          usage();
+          return -1;
+        }
+        break;
+      case 'r':
+        if (sscanf(optarg, "%d:%d", &refine_bands, &refine_order) < 1 ||
+            refine_bands <= 0 || refine_order <= 0 || (refine_order & 0x1)) {
+          usage();
+          return -1;
+        }
+        break;
+      case 'f':
+        if ((int)(out_format = report_format_of(optarg)) < 0) {
+          usage();
+          return -1;
+        }
+        break;
+      case 'o':
+        out_path = optarg;
+        break;
+      case 'H':
+        arena_flags |= ARENA_HUGEPAGES;
+        break;
+      case 'e':
+        if (!strcmp(optarg, "direct")) {
+          engine = SCAN_DIRECT;
+        } else if (!strcmp(optarg, "fft")) {
+          engine = SCAN_FFT;
+        } else if (!strcmp(optarg, "welch")) {
+          use_welch = 1;
+        } else if (!strcmp(optarg, "iir")) {
+          engine = SCAN_IIR;
+        } else {
+          usage();
+          return -1;
+        }
+        break;
+      case 'W':
+        wisdom_path = optarg;
+        break;
+      case 'A':
+        demod_path = optarg;
+        break;
+      case 'a': {
+        wav_path = optarg;
+        char* colon = strchr(optarg, ':');
+        if (colon) {
+          *colon = 0;
+          wav_rate = atoi(colon + 1);
+        }
+        if (wav_rate <= 0) {
+          usage();
+          return -1;
+        }
+        break;
+      }
+      case 'D':
+        if (filter_spec_of(optarg, &design)) {
+          usage();
+          return -1;
+        }
+        use_design = 1;
+        break;
+      default:
+        usage();
+        return -1;
+    }
+  }
+  argc -= optind - 1;
+  argv += optind - 1;
+
   if (argc != 8) {
     usage();
     return -1;
@@ -290,10 +787,58 @@ int main(int argc, char* argv[]) {
   num_threads = atoi(argv[6]);
   num_processors = atoi(argv[7]);
 
+  assert(num_threads > 0 && num_processors > 0);
+
+  if (iq && (detect_only || prescreen || sample_stride || refine_bands || use_welch ||
+             engine == SCAN_IIR || demod_path || wav_path || use_design)) {
+    printf("-q only supports a full scan, by direct convolution or FFT\n");
+    return -1;
+  }
+
+  // the analysis modes replace one another, so at most one of them
+  if (detect_only + prescreen + (sample_stride > 0) + use_welch > 1) {
+    printf("-d/-F, -P, -S and -e welch are alternative analysis modes, pick one\n");
+    return -1;
+  }
+
+  // and they bound, sample or decide on the FIR bank's outputs
+  if (engine == SCAN_IIR && (detect_only || prescreen || sample_stride)) {
+    printf("-d/-F, -P and -S work on the FIR bank, they can't be used with -e iir\n");
+    return -1;
+  }
+
   assert(Fs > 0.0);
-  assert(filter_order > 0 && !(filter_order & 0x1));
   assert(num_bands > 0);
 
+  // each refinement level halves every band, so only these are reachable
+  int levels = refine_bands / num_bands;
+  if (refine_bands && (refine_bands % num_bands || levels < 2 || (levels & (levels - 1)))) {
+    printf("-r refines to num_bands times a power of 2 bands (%d, %d, %d, ...), not %d\n",
+           2 * num_bands, 4 * num_bands, 8 * num_bands, refine_bands);
+    return -1;
+  }
+
+  if (out_format != REPORT_TEXT && (out_fd = report_open(out_path)) < 0) {
+    return -1;
+  }
+
+  if (use_design) {
+    // sized on the middle band; the rest differ by a tap or two at most
+    if (design.transition <= 0) {
+      design.transition = Fs / 2 / num_bands;
+    }
+    int mid = num_bands / 2;
+    filter_order = design_min_order(&design, Fs, BAND_LOW(mid, Fs / 2 / num_bands),
+                                    BAND_HIGH(mid, Fs / 2 / num_bands));
+    if (filter_order < 0) {
+      printf("No filter up to order %d meets %lf dB with a %lf Hz transition\n",
+             DESIGN_MAX_ORDER, design.atten, design.transition);
+      return -1;
+    }
+    scan_use_design(&design);
+  }
+  assert(filter_order > 0 && !(filter_order & 0x1));
+
   printf("type:     %s\n\
 file:     %s\n\
 Fs:       %lf Hz\n\
@@ -304,6 +849,24 @@ bands:    %d\n",
          Fs,
          filter_order,
          num_bands);
+  if (use_design) {
+    char* names[] = {"hamming", "kaiser", "remez"};
+    printf("design:   %s, %lf dB, %lf Hz transition (Hamming: order %d, ~53 dB)\n",
+           names[design.design], design.design == DESIGN_HAMMING ? 53.0 : design.atten,
+           design.transition, (int)ceil(3.3 * Fs / design.transition / 2) * 2);
+  }
+
+  scan_use_engine(engine);
+  if (wisdom_path && !fft_import_wisdom(wisdom_path)) {
+    printf("FFT wisdom loaded from %s\n", wisdom_path);
+  }
+
+  // everything the run allocates comes from one arena, released at the end
+  arena* run = arena_create(0, arena_flags);
+  if (!run) {
+    return -1;
+  }
+  arena_set_run(run);
 
   printf("Load or map file\n");
 
@@ -332,6 +895,14 @@ bands:    %d\n",
   }
 
   sig->Fs = Fs;
+  if (iq) {
+    if (signal_to_iq(sig)) {
+      printf("An I/Q file needs an even number of values\n");
+      return -1;
+    }
+    report_band_origin(-Fs / 2);
+    printf("I/Q: %d complex samples, -Fs/2..Fs/2\n", sig->num_samples);
+  }
 
   double start = 0;
   double end   = 0;
@@ -341,7 +912,19 @@ bands:    %d\n",
     printf("no aliens\n");
   }
 
+  if (engine == SCAN_FFT) {
+    long made, reused;
+    fft_plan_stats(&made, &reused);
+    printf("FFT plans: %ld made, %ld reused\n", made, reused);
+  }
+  if (wisdom_path && fft_export_wisdom(wisdom_path)) {
+    printf("Cannot save FFT wisdom to %s\n", wisdom_path);
+  }
+  fft_cleanup();
+
   free_signal(sig);
+  arena_set_run(0);
+  arena_destroy(run);
 
   return 0;
 }
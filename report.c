@@ -0,0 +1,248 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <assert.h>
+
+#include "report.h"
+
+
+double band_origin = 0;
+
+void report_band_origin(double f0) {
+  band_origin = f0;
+}
+
+int in_alien_window(double band_low, double band_high) {
+  return (band_low >= ALIENS_LOW && band_low <= ALIENS_HIGH) ||
+         (band_high >= ALIENS_LOW && band_high <= ALIENS_HIGH);
+}
+
+// Room for one table line: the numeric fields (~80 chars for sane
+// values), up to MAXWIDTH stars and the flag
+#define REPORT_FIELDS_MAX 160
+#define REPORT_LINE_MAX   (REPORT_FIELDS_MAX + MAXWIDTH + 8)
+
+// Write the whole buffer to stdout with as few write() calls as possible,
+// after anything already sitting in stdio's buffer
+static void write_out(char* buf, long len) {
+  fflush(stdout);
+  while (len > 0) {
+    long n = write(1, buf, len);
+    if (n <= 0) {
+      perror("Write failure");
+      return;
+    }
+    buf += n;
+    len -= n;
+  }
+}
+
+int report_bands(int num_bands, double bandwidth, double* band_power,
+                 double avg_band_power, double* lb, double* ub) {
+
+  double max_band_power = band_power[0];
+  for (int band = 1; band < num_bands; band++) {
+    if (band_power[band] > max_band_power) {
+      max_band_power = band_power[band];
+    }
+  }
+
+  int wow = 0;
+  *lb = -1;
+  *ub = -1;
+
+  // the table is formatted into one buffer and written with one syscall
+  // instead of a printf per field and per star
+  char* buf = malloc((long)num_bands * REPORT_LINE_MAX);
+  char* cur = buf;
+  if (!buf) {
+    perror("Not enough memory");
+    return 0;
+  }
+
+  for (int band = 0; band < num_bands; band++) {
+    double band_low  = BAND_LOW(band, bandwidth);
+    double band_high = BAND_HIGH(band, bandwidth);
+
+    if (band_power[band] < 0) {
+      int n = snprintf(cur, REPORT_FIELDS_MAX, "%5d %20lf to %20lf Hz: %20s (skipped)\n",
+                       band, band_low, band_high, "-");
+      cur += n < REPORT_FIELDS_MAX ? n : REPORT_FIELDS_MAX - 1;
+      continue;
+    }
+
+    char* line = cur;
+    int n = snprintf(cur, REPORT_FIELDS_MAX, "%5d %20lf to %20lf Hz: %20lf ",
+                     band, band_low, band_high, band_power[band]);
+    cur += n < REPORT_FIELDS_MAX ? n : REPORT_FIELDS_MAX - 1;
+
+    int stars = 0;
+    while (stars < MAXWIDTH * (band_power[band] / max_band_power)) {
+      stars++;
+    }
+    memset(cur, '*', stars);
+    cur += stars;
+
+    if (in_alien_window(band_low, band_high) &&
+        band_power[band] > THRESHOLD * avg_band_power) {
+      // band of interest
+      memcpy(cur, "(WOW)\n", 6);
+      wow = 1;
+      if (*lb < 0) {
+        *lb = band_low;
+      }
+      *ub = band_high;
+    } else {
+      memcpy(cur, "(meh)\n", 6);
+    }
+    cur += 6;
+    assert(cur - line <= REPORT_LINE_MAX);
+  }
+
+  write_out(buf, cur - buf);
+  free(buf);
+
+  return wow;
+}
+
+void report_resources(resources* rdiff) {
+  printf("Resource usages:\n\
+User time        %lf seconds\n\
+System time      %lf seconds\n\
+Page faults      %ld\n\
+Page swaps       %ld\n\
+Blocks of I/O    %ld\n\
+Signals caught   %ld\n\
+Context switches %ld\n",
+         rdiff->usertime,
+         rdiff->systime,
+         rdiff->pagefaults,
+         rdiff->pageswaps,
+         rdiff->ioblocks,
+         rdiff->sigs,
+         rdiff->contextswitches);
+}
+
+
+int report_format_of(char* name) {
+  if (!strcmp(name, "text")) {
+    return REPORT_TEXT;
+  } else if (!strcmp(name, "json")) {
+    return REPORT_JSON;
+  } else if (!strcmp(name, "csv")) {
+    return REPORT_CSV;
+  } else if (!strcmp(name, "bin")) {
+    return REPORT_BINARY;
+  }
+  return -1;
+}
+
+int report_open(char* path) {
+
+  if (path) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+      perror("Cannot open output file");
+    }
+    return fd;
+  }
+
+  // keep the real stdout for results, everything printed goes to stderr
+  fflush(stdout);
+  int fd = dup(1);
+  if (fd < 0 || dup2(2, 1) < 0) {
+    perror("Cannot redirect stdout");
+    return -1;
+  }
+  return fd;
+}
+
+static int write_all(int fd, void* data, long len) {
+  char* cur = (char*)data;
+  while (len > 0) {
+    long n = write(fd, cur, len);
+    if (n <= 0) {
+      perror("Write failure");
+      return -1;
+    }
+    cur += n;
+    len -= n;
+  }
+  return 0;
+}
+
+int report_structured(int fd, report_format format,
+                      report_record* r, double* band_power) {
+
+  r->magic   = REPORT_MAGIC;
+  r->version = REPORT_VERSION;
+
+  if (format == REPORT_BINARY) {
+    return write_all(fd, r, sizeof(*r)) ||
+           write_all(fd, band_power, r->num_bands * sizeof(double)) ? -1 : 0;
+  }
+
+  // like the table, everything is formatted into one buffer first
+  long size = (long)(r->num_bands + 4) * 256 + 1024;
+  char* buf = malloc(size);
+  char* cur = buf;
+  if (!buf) {
+    perror("Not enough memory");
+    return -1;
+  }
+
+  if (format == REPORT_CSV) {
+    cur += sprintf(cur, "band,low_hz,high_hz,power,in_window,wow\n");
+  }
+
+  for (int band = 0; band < r->num_bands; band++) {
+    double band_low  = BAND_LOW(band, r->bandwidth);
+    double band_high = BAND_HIGH(band, r->bandwidth);
+    int window = in_alien_window(band_low, band_high);
+    int wow = window && band_power[band] > THRESHOLD * r->avg_band_power;
+
+    if (format == REPORT_JSON) {
+      cur += sprintf(cur, "{\"type\":\"band\",\"band\":%d,\"low_hz\":%.17g,\"high_hz\":%.17g,"
+                     "\"power\":%.17g,\"scanned\":%s,\"in_window\":%s,\"wow\":%s}\n",
+                     band, band_low, band_high, band_power[band],
+                     band_power[band] < 0 ? "false" : "true",
+                     window ? "true" : "false", wow ? "true" : "false");
+    } else {
+      cur += sprintf(cur, "%d,%.17g,%.17g,%.17g,%d,%d\n",
+                     band, band_low, band_high, band_power[band], window, wow);
+    }
+  }
+
+  double center = r->wow ? (r->lb + r->ub) / 2.0 : -1;
+
+  if (format == REPORT_JSON) {
+    cur += sprintf(cur, "{\"type\":\"result\",\"aliens\":%s,\"low_hz\":%.17g,\"high_hz\":%.17g,"
+                   "\"center_hz\":%.17g,\"Fs\":%.17g,\"samples\":%d,\"order\":%d,\"bands\":%d,"
+                   "\"signal_power\":%.17g,\"avg_band_power\":%.17g,\"seconds\":%.9g,\"cycles\":%llu,"
+                   "\"usertime\":%.6f,\"systime\":%.6f,\"pagefaults\":%ld,\"pageswaps\":%ld,"
+                   "\"ioblocks\":%ld,\"signals\":%ld,\"contextswitches\":%ld}\n",
+                   r->wow ? "true" : "false", r->lb, r->ub, center,
+                   r->Fs, r->num_samples, r->filter_order, r->num_bands,
+                   r->signal_power, r->avg_band_power, r->seconds, r->cycles,
+                   r->rusage.usertime, r->rusage.systime, r->rusage.pagefaults,
+                   r->rusage.pageswaps, r->rusage.ioblocks, r->rusage.sigs,
+                   r->rusage.contextswitches);
+  } else {
+    cur += sprintf(cur, "\naliens,low_hz,high_hz,center_hz,Fs,samples,order,bands,"
+                   "signal_power,avg_band_power,seconds,cycles,usertime,systime,"
+                   "pagefaults,pageswaps,ioblocks,signals,contextswitches\n"
+                   "%d,%.17g,%.17g,%.17g,%.17g,%d,%d,%d,%.17g,%.17g,%.9g,%llu,%.6f,%.6f,%ld,%ld,%ld,%ld,%ld\n",
+                   r->wow, r->lb, r->ub, center,
+                   r->Fs, r->num_samples, r->filter_order, r->num_bands,
+                   r->signal_power, r->avg_band_power, r->seconds, r->cycles,
+                   r->rusage.usertime, r->rusage.systime, r->rusage.pagefaults,
+                   r->rusage.pageswaps, r->rusage.ioblocks, r->rusage.sigs,
+                   r->rusage.contextswitches);
+  }
+
+  int rc = write_all(fd, buf, cur - buf);
+  free(buf);
+  return rc;
+}
@@ -0,0 +1,90 @@
+#ifndef _report
+#define _report
+
+#include "timing.h"
+
+/*
+ *  Band scan results reporting shared by the scan programs
+ *
+ *  The spectrum 0..Fs/2 is split into num_bands bands of equal width,
+ *  band b covering BAND_LOW(b, bandwidth) to BAND_HIGH(b, bandwidth).
+ *  For complex (I/Q) signals the spectrum is -Fs/2..Fs/2, and the bands
+ *  start from report_band_origin(-Fs/2) instead of 0.
+ *  A band is interesting (WOW) if it overlaps the alien window and its
+ *  power is over THRESHOLD times the average band power.
+ */
+
+#define MAXWIDTH 40
+#define THRESHOLD 2.0
+#define ALIENS_LOW  50000.0
+#define ALIENS_HIGH 150000.0
+
+#define BAND_LOW(band, bandwidth)  (band_origin + (band) * (bandwidth) + 0.0001)  // keep within limits
+#define BAND_HIGH(band, bandwidth) (band_origin + ((band) + 1) * (bandwidth) - 0.0001)
+
+extern double band_origin;    // 0 unless set by report_band_origin
+
+void report_band_origin(double f0);
+
+// Does the band overlap ALIENS_LOW..ALIENS_HIGH?
+int in_alien_window(double band_low, double band_high);
+
+// Print the band power table with its bars and WOW/meh flags.  Bands with
+// negative power were not scanned and are listed as skipped.  Returns 1 if
+// any band is WOW, with the lowest and highest WOW band edges in lb/ub.
+int report_bands(int num_bands, double bandwidth, double* band_power,
+                 double avg_band_power, double* lb, double* ub);
+
+// Print the resource usage block
+void report_resources(resources* rdiff);
+
+
+/*
+ *  Machine readable results
+ *
+ *  -f json   one JSON object per line: a "band" record per band, then a
+ *            "result" record with the verdict, timing and resources
+ *  -f csv    a band table (band,low_hz,high_hz,power,in_window,wow), a
+ *            blank line, then a one-row result table
+ *  -f bin    one report_record followed by num_bands doubles of band
+ *            power (negative = not scanned), native byte order
+ *
+ *  Structured results go to the file given with -o, or to stdout, in
+ *  which case all the human-readable output is moved to stderr.
+ */
+
+typedef enum {REPORT_TEXT, REPORT_JSON, REPORT_CSV, REPORT_BINARY} report_format;
+
+#define REPORT_MAGIC   0x49544553  // "SETI"
+#define REPORT_VERSION 1
+
+typedef struct report_record {
+  unsigned int magic;
+  unsigned int version;
+  int num_bands;
+  int filter_order;
+  int num_samples;
+  int wow;                   // 1 if POSSIBLE ALIENS
+  double Fs;
+  double bandwidth;
+  double signal_power;       // after DC removal
+  double avg_band_power;     // what WOW bands were compared against
+  double lb;                 // lowest WOW band edge, -1 if none
+  double ub;                 // highest WOW band edge, -1 if none
+  double seconds;            // analysis time by basic timing
+  unsigned long long cycles; // analysis time by cycle count
+  resources rusage;
+} report_record;
+
+// Parse a -f argument, -1 if unknown
+int report_format_of(char* name);
+
+// File descriptor for structured results: path, or stdout if path is 0,
+// in which case stdout is redirected to stderr for everything else
+int report_open(char* path);
+
+// Write the results in the given (non-text) format to fd
+int report_structured(int fd, report_format format,
+                      report_record* r, double* band_power);
+
+#endif
@@ -0,0 +1,304 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+#include "filter.h"
+#include "signal.h"
+#include "timing.h"
+#include "fft.h"
+
+/*
+ * Single-core roofline report for the band scan.
+ *
+ * 1. measure peak FMA throughput with many independent multiply-add chains
+ * 2. measure sustainable memory bandwidth with a STREAM-style triad
+ * 3. derive the arithmetic intensity (flops/byte of DRAM traffic) of each
+ *    band scan engine from its flop and byte counts
+ * 4. time the engines we have on the given signal and report where each
+ *    run sits relative to min(peak, intensity * bandwidth)
+ */
+
+#define FMA_CHAINS   64         // most independent chains any variant runs
+#define STREAM_LEN   (1 << 22)  // 32 MB per array, well past the LLC
+#define STREAM_REPS  5
+#define MIN_TIME     0.2        // seconds each peak measurement should run
+
+void usage() {
+  printf("usage: roofline text|bin|mmap signal_file Fs filter_order num_bands\n");
+}
+
+// The FMA chains, compiled for each instruction set the filter kernels
+// come in, so the peak is measured with the same vector width the
+// kernels actually use.  Each variant runs 8 vector registers' worth of
+// chains: enough to cover the FMA latency, few enough to stay in registers.
+static inline __attribute__((always_inline))
+void fma_chains(double* acc, int chains, long iters, double m, double a) {
+  for (long it = 0; it < iters; it++) {
+    for (int k = 0; k < chains; k++) {
+      acc[k] = acc[k] * m + a;
+    }
+  }
+}
+
+static void fma_chains_generic(double* acc, long iters, double m, double a) {
+  fma_chains(acc, 16, iters, m, a);
+}
+
+#ifdef __x86_64__
+__attribute__((target("sse4.2")))
+static void fma_chains_sse42(double* acc, long iters, double m, double a) {
+  fma_chains(acc, 16, iters, m, a);
+}
+
+__attribute__((target("avx2,fma")))
+static void fma_chains_avx2(double* acc, long iters, double m, double a) {
+  fma_chains(acc, 32, iters, m, a);
+}
+
+__attribute__((target("avx512f,fma,prefer-vector-width=512")))
+static void fma_chains_avx512(double* acc, long iters, double m, double a) {
+  fma_chains(acc, 64, iters, m, a);
+}
+#endif
+
+double measure_peak_flops() {
+
+  double acc[FMA_CHAINS];
+  double m = 0.999999;
+  double a = 1e-7;
+
+  void (*chains)(double*, long, double, double) = fma_chains_generic;
+  int num_chains = 16;
+#ifdef __x86_64__
+  if (!strcmp(filter_isa(), "avx512")) {
+    chains = fma_chains_avx512;
+    num_chains = 64;
+  } else if (!strcmp(filter_isa(), "avx2")) {
+    chains = fma_chains_avx2;
+    num_chains = 32;
+  } else if (!strcmp(filter_isa(), "sse4.2")) {
+    chains = fma_chains_sse42;
+  }
+#endif
+
+  for (int k = 0; k < FMA_CHAINS; k++) {
+    acc[k] = k * 1e-3;
+  }
+
+  long iters = 1024;
+  double t;
+  do {
+    iters *= 2;
+    double start = get_seconds();
+    chains(acc, iters, m, a);
+    t = get_seconds_diff(start);
+  } while (t < MIN_TIME);
+
+  // keep the chains live
+  double sink = 0;
+  for (int k = 0; k < FMA_CHAINS; k++) {
+    sink += acc[k];
+  }
+  if (sink == 42.0) {
+    printf("%lf\n", sink);
+  }
+
+  return 2.0 * num_chains * iters / t;
+}
+
+double measure_bandwidth() {
+
+  double* a = malloc(sizeof(double) * STREAM_LEN);
+  double* b = malloc(sizeof(double) * STREAM_LEN);
+  double* c = malloc(sizeof(double) * STREAM_LEN);
+  assert(a && b && c);
+
+  for (int i = 0; i < STREAM_LEN; i++) {
+    a[i] = 0;
+    b[i] = 1.0;
+    c[i] = 2.0;
+  }
+
+  double best = -1;
+  for (int r = 0; r < STREAM_REPS; r++) {
+    double start = get_seconds();
+    for (int i = 0; i < STREAM_LEN; i++) {
+      a[i] = b[i] + 3.0 * c[i];
+    }
+    double t = get_seconds_diff(start);
+    if (best < 0 || t < best) {
+      best = t;
+    }
+  }
+
+  if (a[STREAM_LEN / 2] != 7.0) {
+    printf("triad check failed\n");
+  }
+
+  free(a);
+  free(b);
+  free(c);
+
+  // two streams read, one written
+  return 3.0 * sizeof(double) * STREAM_LEN / best;
+}
+
+typedef struct engine {
+  const char* name;
+  double flops;     // total floating point operations for the scan
+  double bytes;     // total DRAM traffic for the scan
+  double seconds;   // measured time, <0 if not measured here
+} engine;
+
+/*
+ * direct:  one FIR pass over the signal per band, coefficients stay in
+ *          cache, so each band streams the whole signal once
+ * fused:   all bands' FIRs evaluated per input sample in one pass, so the
+ *          signal is streamed once for the whole bank
+ * fft:     overlap-save per band, blocks of fft_block_size; forward and inverse
+ *          real transforms (~2.5 L log2 L each), a complex multiply per bin
+ *          and the power sum, signal streamed once per band
+ */
+void model_engines(int N, int order, int bands, engine* direct, engine* fused, engine* fft) {
+
+  double taps = order + 1;
+
+  direct->name  = "direct";
+  direct->flops = 2.0 * taps * N * bands;
+  direct->bytes = sizeof(double) * (double)N * bands;
+
+  fused->name  = "fused multi-band";
+  fused->flops = direct->flops;
+  fused->bytes = sizeof(double) * (double)N;
+
+  int L = fft_block_size(order);
+  double blocks = ceil((double)N / (L - order));
+  double per_block = 2 * 2.5 * L * log2(L) + 6.0 * (L / 2 + 1) + 2.0 * (L - order);
+
+  fft->name  = "fft overlap-save";
+  fft->flops = per_block * blocks * bands;
+  fft->bytes = sizeof(double) * (double)N * bands;
+
+  direct->seconds = fused->seconds = fft->seconds = -1;
+}
+
+double time_engine(signal* sig, int filter_order, int num_bands, int fft) {
+
+  double bandwidth = (sig->Fs / 2) / num_bands;
+  double filter_coeffs[filter_order + 1];
+  double power;
+
+  double start = get_seconds();
+  for (int band = 0; band < num_bands; band++) {
+    generate_band_pass(sig->Fs,
+                       band * bandwidth + 0.0001,
+                       (band + 1) * bandwidth - 0.0001,
+                       filter_order,
+                       filter_coeffs);
+    hamming_window(filter_order, filter_coeffs);
+    if (fft) {
+      fft_convolve_dc_and_compute_power(sig->num_samples,
+                                        sig->data,
+                                        0.0,
+                                        filter_order,
+                                        filter_coeffs,
+                                        &power);
+    } else {
+      convolve_and_compute_power(sig->num_samples,
+                                 sig->data,
+                                 filter_order,
+                                 filter_coeffs,
+                                 &power);
+    }
+  }
+  return get_seconds_diff(start);
+}
+
+void report(engine* e, double peak, double bw) {
+
+  double ai = e->flops / e->bytes;
+  double roof = fmin(peak, ai * bw);
+
+  printf("%-18s %10.3f flops/byte  roof %8.3f GFLOP/s (%s bound)",
+         e->name, ai, roof / 1e9, ai * bw < peak ? "memory" : "compute");
+
+  if (e->seconds > 0) {
+    double achieved = e->flops / e->seconds;
+    printf("  measured %8.3f GFLOP/s = %5.1f%% of roof, %5.1f%% of peak\n",
+           achieved / 1e9, 100.0 * achieved / roof, 100.0 * achieved / peak);
+  } else {
+    printf("  (model only)\n");
+  }
+}
+
+int main(int argc, char* argv[]) {
+
+  if (argc != 6) {
+    usage();
+    return -1;
+  }
+
+  char sig_type    = toupper(argv[1][0]);
+  char* sig_file   = argv[2];
+  double Fs        = atof(argv[3]);
+  int filter_order = atoi(argv[4]);
+  int num_bands    = atoi(argv[5]);
+
+  assert(Fs > 0.0);
+  assert(filter_order > 0 && !(filter_order & 0x1));
+  assert(num_bands > 0);
+
+  signal* sig;
+  switch (sig_type) {
+    case 'T':
+      sig = load_text_format_signal(sig_file);
+      break;
+
+    case 'B':
+      sig = load_binary_format_signal(sig_file);
+      break;
+
+    case 'M':
+      sig = map_binary_format_signal(sig_file);
+      break;
+
+    default:
+      printf("Unknown signal type\n");
+      return -1;
+  }
+
+  if (!sig) {
+    printf("Unable to load or map file\n");
+    return -1;
+  }
+
+  sig->Fs = Fs;
+
+  printf("Measuring machine limits (single core)\n");
+  double peak = measure_peak_flops();
+  double bw   = measure_bandwidth();
+  printf("peak FMA throughput: %10.3f GFLOP/s\n", peak / 1e9);
+  printf("stream bandwidth:    %10.3f GB/s\n", bw / 1e9);
+  printf("ridge point:         %10.3f flops/byte\n\n", peak / bw);
+
+  engine direct, fused, fft;
+  model_engines(sig->num_samples, filter_order, num_bands, &direct, &fused, &fft);
+
+  printf("Timing engines on %d samples, order %d, %d bands, %s kernels\n\n",
+         sig->num_samples, filter_order, num_bands, filter_isa());
+  direct.seconds = time_engine(sig, filter_order, num_bands, 0);
+  // plan outside the timing, as a run with wisdom would
+  fft_prepare(sig->num_samples, filter_order);
+  fft.seconds = time_engine(sig, filter_order, num_bands, 1);
+
+  report(&direct, peak, bw);
+  report(&fused, peak, bw);
+  report(&fft, peak, bw);
+
+  free_signal(sig);
+
+  return 0;
+}
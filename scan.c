@@ -0,0 +1,1110 @@
+#define _GNU_SOURCE
+#include <sched.h>    // for processor affinity
+#include <unistd.h>   // unix standard apis
+#include <pthread.h>  // pthread api
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <fftw3.h>
+
+#include "filter.h"
+#include "report.h"
+#include "scan.h"
+#include "arena.h"
+#include "fft.h"
+
+
+#define CACHE_LINE 64
+#define SLOT_ROUND (CACHE_LINE / sizeof(double))  // doubles per cache line
+
+static scan_engine engine = SCAN_DIRECT;
+
+void scan_use_engine(scan_engine e) {
+  engine = e;
+}
+
+static filter_spec design = {DESIGN_HAMMING, 0, 0};
+
+void scan_use_design(filter_spec* spec) {
+  design = *spec;
+}
+
+typedef struct inputs{
+  int id;
+  int num_threads;
+  int processor;        // where to pin this thread
+  int num_processors;
+  double bandwidth;
+  int filterOrder;
+  signal* sig;
+  double dc;            // DC component, subtracted on the fly
+  double dc_q;          // and Q's, for I/Q signals
+  double* slot;         // this thread's results, in the order it scans
+  int stride;           // > 0: estimate from one output in stride
+  double* error_slot;   //      with these errors
+  double* coeffs;       // this thread's filter, order + 1 doubles
+  int* bands;           // which bands to scan
+  int num_scan;         // how many of them
+} __attribute__((aligned(CACHE_LINE))) inputs;
+
+
+// put ourselves on the desired processor
+static void pin(int processor) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(processor, &set);
+  if (sched_setaffinity(0, sizeof(set), &set) < 0) { // do it
+    perror("Can't setaffinity"); // hopefully doesn't fail
+    exit(-1);
+  }
+}
+
+static void* worker(void* arg) {
+  inputs *input = (inputs*)arg;
+
+  pin(input->processor);
+  fft_pin_threads(input->processor, input->num_processors);
+
+  double* filterCoeffs = input->coeffs;
+
+  // the IIR engine runs all of this thread's bands in one pass
+  if (engine == SCAN_IIR && input->stride == 0 && !input->sig->iq) {
+    int num_mine = (input->num_scan - input->id + input->num_threads - 1) / input->num_threads;
+    double low[num_mine > 0 ? num_mine : 1];
+    double high[num_mine > 0 ? num_mine : 1];
+    for (int k = input->id, m = 0; k < input->num_scan; k += input->num_threads, m++) {
+      low[m] = BAND_LOW(input->bands[k], input->bandwidth);
+      high[m] = BAND_HIGH(input->bands[k], input->bandwidth);
+    }
+    if (num_mine > 0 &&
+        iir_bank_power(input->sig->num_samples, input->sig->data, input->dc, input->sig->Fs,
+                       num_mine, low, high, input->slot) < 0) {
+      perror("Not enough memory");
+      exit(-1);
+    }
+    pthread_exit(NULL);
+  }
+
+  // bands are dealt out round-robin, so thread i gets scan entries
+  // i, i + num_threads, ...
+  int mine = 0;
+  for (int k = input->id; k < input->num_scan; k += input->num_threads) {
+    int band = input->bands[k];
+
+    // complex signals: the band mixed down to 0 Hz and low passed
+    if (input->sig->iq) {
+      double low = BAND_LOW(band, input->bandwidth);
+      double high = BAND_HIGH(band, input->bandwidth);
+      double omega = M_PI * (low + high) / input->sig->Fs;
+      generate_low_pass(input->sig->Fs, (high - low) / 2, input->filterOrder, filterCoeffs);
+      hamming_window(input->filterOrder, filterCoeffs);
+      int rc = engine == SCAN_FFT ?
+        fft_convolve_iq_and_compute_power(input->sig->num_samples, input->sig->data,
+                                          input->dc, input->dc_q, omega,
+                                          input->filterOrder, filterCoeffs,
+                                          &(input->slot[mine])) :
+        convolve_iq_and_compute_power(input->sig->num_samples, input->sig->data,
+                                      input->dc, input->dc_q, omega,
+                                      input->filterOrder, filterCoeffs,
+                                      &(input->slot[mine]));
+      if (rc < 0) {
+        perror("Not enough memory");
+        exit(-1);
+      }
+      mine++;
+      continue;
+    }
+
+    design_band_pass(&design,
+                     input->sig->Fs,
+                     BAND_LOW(band, input->bandwidth),
+                     BAND_HIGH(band, input->bandwidth),
+                     input->filterOrder,
+                     filterCoeffs);
+
+    if (input->stride > 0) {
+      convolve_dc_and_estimate_power(input->sig->num_samples,
+                                     input->sig->data,
+                                     input->dc,
+                                     input->filterOrder,
+                                     filterCoeffs,
+                                     input->stride,
+                                     band,
+                                     &(input->slot[mine]),
+                                     &(input->error_slot[mine]));
+      mine++;
+    } else if (engine == SCAN_FFT) {
+      fft_convolve_dc_and_compute_power(input->sig->num_samples,
+                                        input->sig->data,
+                                        input->dc,
+                                        input->filterOrder,
+                                        filterCoeffs,
+                                        &(input->slot[mine++]));
+    } else {
+      convolve_dc_and_compute_power(input->sig->num_samples,
+                                    input->sig->data,
+                                    input->dc,
+                                    input->filterOrder,
+                                    filterCoeffs,
+                                    &(input->slot[mine++]));
+    }
+  }
+
+  // Done.  The master thread will look at the band powers
+  pthread_exit(NULL);           // finish - no return value
+}
+
+static void run_bands(signal* sig, double dc, double dc_q, int filter_order, double bandwidth,
+                      double* band_power, int* bands, int num_scan,
+                      int sample_stride, double* band_error,
+                      int num_threads, int first_processor, int num_processors) {
+
+  // With fewer bands than threads the FFT engine can still use them all:
+  // one worker per band, each transform run by the worker plus FFTW
+  // threads pinned to the processors after it
+  int spread = 1;
+  if (engine == SCAN_FFT && sample_stride == 0) {
+    int workers = num_scan < num_threads ? (num_scan > 0 ? num_scan : 1) : num_threads;
+    spread = num_threads / workers;
+    num_threads = workers;
+  }
+  fft_set_threads(spread);
+
+  pthread_t* tid = run_alloc(num_threads * sizeof(pthread_t));  // array of thread ids
+  inputs* thread_inputs = run_alloc(num_threads * sizeof(inputs));
+
+  // Each thread gets its own slot of whole cache lines for its results,
+  // so threads finishing bands never write to a line another thread is
+  // using.  The slots are gathered into band_power after the join.
+  int per_thread = (num_scan + num_threads - 1) / num_threads;
+  int stride = (per_thread + SLOT_ROUND - 1) / SLOT_ROUND * SLOT_ROUND;
+  double* slots = run_alloc(((long)num_threads * stride + SLOT_ROUND) * sizeof(double));
+  double* error_slots = band_error ?
+    run_alloc(((long)num_threads * stride + SLOT_ROUND) * sizeof(double)) : 0;
+
+  // and its own aligned filter, likewise whole cache lines
+  int coeff_stride = (filter_order + 1 + SLOT_ROUND - 1) / SLOT_ROUND * SLOT_ROUND;
+  double* coeffs = run_alloc((long)num_threads * coeff_stride * sizeof(double));
+
+  for (int i = 0; i < num_threads; i++) {
+    thread_inputs[i].id = i;
+    thread_inputs[i].num_threads = num_threads;
+    thread_inputs[i].processor = (first_processor + i * spread) % num_processors;
+    thread_inputs[i].num_processors = num_processors;
+    thread_inputs[i].bandwidth = bandwidth;
+    thread_inputs[i].filterOrder = filter_order;
+    thread_inputs[i].sig = sig;
+    thread_inputs[i].dc = dc;
+    thread_inputs[i].dc_q = dc_q;
+    thread_inputs[i].slot = slots + (long)i * stride;
+    thread_inputs[i].stride = sample_stride;
+    thread_inputs[i].error_slot = band_error ? error_slots + (long)i * stride : 0;
+    thread_inputs[i].coeffs = coeffs + (long)i * coeff_stride;
+    thread_inputs[i].bands = bands;
+    thread_inputs[i].num_scan = num_scan;
+    int returncode = pthread_create(&(tid[i]),  // thread id gets put here
+                                    NULL, // use default attributes
+                                    worker, // thread will begin in this function
+                                    &(thread_inputs[i])
+                                    );
+    if (returncode != 0) {
+      perror("Failed to start thread");
+      exit(-1);
+    }
+  }
+
+  // now we will join all the threads
+  for (int i = 0; i < num_threads; i++) {
+    int returncode = pthread_join(tid[i], NULL);
+    if (returncode != 0) {
+      perror("join failed");
+      exit(-1);
+    }
+  }
+
+  // deterministic gather, in scan order
+  for (int k = 0; k < num_scan; k++) {
+    band_power[bands[k]] = slots[(long)(k % num_threads) * stride + k / num_threads];
+    if (band_error) {
+      band_error[bands[k]] = error_slots[(long)(k % num_threads) * stride + k / num_threads];
+    }
+  }
+
+  run_free(coeffs);
+  run_free(error_slots);
+  run_free(slots);
+  run_free(thread_inputs);
+  run_free(tid);
+}
+
+void scan_bands(signal* sig, double dc, int filter_order, double bandwidth,
+                double* band_power, int* bands, int num_scan,
+                int num_threads, int first_processor, int num_processors) {
+  run_bands(sig, dc, 0, filter_order, bandwidth, band_power, bands, num_scan, 0, 0,
+            num_threads, first_processor, num_processors);
+}
+
+void scan_bands_iq(signal* sig, double dc_i, double dc_q, int filter_order, double bandwidth,
+                   double* band_power, int* bands, int num_scan,
+                   int num_threads, int first_processor, int num_processors) {
+  run_bands(sig, dc_i, dc_q, filter_order, bandwidth, band_power, bands, num_scan, 0, 0,
+            num_threads, first_processor, num_processors);
+}
+
+void scan_estimate(signal* sig, double dc, int filter_order, double bandwidth,
+                   int stride, double* band_power, double* band_error,
+                   int* bands, int num_scan,
+                   int num_threads, int first_processor, int num_processors) {
+  run_bands(sig, dc, 0, filter_order, bandwidth, band_power, bands, num_scan,
+            stride, band_error, num_threads, first_processor, num_processors);
+}
+
+
+typedef struct stats_inputs {
+  int processor;
+  double* data;
+  long num;
+  int iq;               // data is num I/Q pairs
+  signal_stats stats;   // result for data[0..num)
+  signal_stats q_stats; // and for Q, if iq
+} __attribute__((aligned(CACHE_LINE))) stats_inputs;
+
+static void* stats_worker(void* arg) {
+  stats_inputs* input = (stats_inputs*)arg;
+
+  pin(input->processor);
+  if (input->iq) {
+    iq_signal_statistics(input->data, input->num, &input->stats, &input->q_stats);
+  } else {
+    signal_statistics(input->data, input->num, &input->stats);
+  }
+
+  pthread_exit(NULL);
+}
+
+static void run_statistics(signal* sig, signal_stats* stats, signal_stats* q_stats,
+                           int num_threads, int first_processor, int num_processors) {
+
+  pthread_t* tid = run_alloc(num_threads * sizeof(pthread_t));
+  stats_inputs* thread_inputs = run_alloc(num_threads * sizeof(stats_inputs));
+
+  // contiguous chunks, so each thread streams through its own part
+  long per_thread = ((long)sig->num_samples + num_threads - 1) / num_threads;
+
+  for (int i = 0; i < num_threads; i++) {
+    long first = i * per_thread < sig->num_samples ? i * per_thread : sig->num_samples;
+    long last  = first + per_thread < sig->num_samples ? first + per_thread : sig->num_samples;
+    thread_inputs[i].processor = (first_processor + i) % num_processors;
+    thread_inputs[i].data = sig->data + (sig->iq ? 2 * first : first);
+    thread_inputs[i].num = last - first;
+    thread_inputs[i].iq = sig->iq;
+    int returncode = pthread_create(&(tid[i]), NULL, stats_worker, &(thread_inputs[i]));
+    if (returncode != 0) {
+      perror("Failed to start thread");
+      exit(-1);
+    }
+  }
+
+  stats->count = 0;
+  if (q_stats) {
+    q_stats->count = 0;
+  }
+  for (int i = 0; i < num_threads; i++) {
+    int returncode = pthread_join(tid[i], NULL);
+    if (returncode != 0) {
+      perror("join failed");
+      exit(-1);
+    }
+    // merged in chunk order, so the result does not depend on timing
+    merge_signal_statistics(stats, &thread_inputs[i].stats);
+    if (q_stats) {
+      merge_signal_statistics(q_stats, &thread_inputs[i].q_stats);
+    }
+  }
+
+  run_free(thread_inputs);
+  run_free(tid);
+}
+
+void scan_statistics(signal* sig, signal_stats* stats,
+                     int num_threads, int first_processor, int num_processors) {
+  run_statistics(sig, stats, 0, num_threads, first_processor, num_processors);
+}
+
+void scan_iq_statistics(signal* sig, signal_stats* i_stats, signal_stats* q_stats,
+                        int num_threads, int first_processor, int num_processors) {
+  run_statistics(sig, i_stats, q_stats, num_threads, first_processor, num_processors);
+}
+
+
+/*
+ * Welch.  The signal is cut into segments of WELCH segment samples
+ * overlapping by half, each Hann windowed and transformed, and the
+ * one-sided |X_k|^2, scaled so they sum to the segment's mean square, are
+ * averaged over the segments.  Each thread sums the spectra of a
+ * contiguous run of segments into its own padded row; the rows are added
+ * in thread order.
+ */
+
+typedef struct welch_inputs {
+  int processor;
+  signal* sig;
+  double dc;
+  int segment;          // samples per segment
+  double* hann;
+  int first;            // segments first .. first + num - 1
+  int num;
+  double* psd;          // this thread's sum, segment / 2 + 1 bins
+  double* frame;        // scratch: segment doubles, then the spectrum
+} __attribute__((aligned(CACHE_LINE))) welch_inputs;
+
+static void* welch_worker(void* arg) {
+  welch_inputs* input = (welch_inputs*)arg;
+
+  pin(input->processor);
+
+  int W = input->segment;
+  int bins = W / 2 + 1;
+  double* frame = input->frame;
+  fftw_complex* spec = (fftw_complex*)(frame + W);
+  fftw_plan plan = fft_plan(W, FFT_R2C, frame, spec);
+
+  for (int k = 0; k < bins; k++) {
+    input->psd[k] = 0;
+  }
+
+  for (int s = input->first; s < input->first + input->num; s++) {
+    double* x = input->sig->data + (long)s * (W / 2);
+    for (int i = 0; i < W; i++) {
+      frame[i] = (x[i] - input->dc) * input->hann[i];
+    }
+    fftw_execute_dft_r2c(plan, frame, spec);
+    for (int k = 0; k < bins; k++) {
+      input->psd[k] += spec[k][0] * spec[k][0] + spec[k][1] * spec[k][1];
+    }
+  }
+
+  pthread_exit(NULL);
+}
+
+int welch_segment(int num_bands) {
+  // at least WELCH_BINS_PER_BAND bins in every band
+  int W = FFT_BLOCK;
+  while (W / 2 < WELCH_BINS_PER_BAND * num_bands) {
+    W *= 2;
+  }
+  return W;
+}
+
+int scan_welch(signal* sig, double dc, int num_bands, double bandwidth,
+               double* band_power,
+               int num_threads, int first_processor, int num_processors) {
+
+  int W = welch_segment(num_bands);
+  int bins = W / 2 + 1;
+  int N = sig->num_samples;
+  if (N < W) {
+    W = N & ~0x1;       // one short segment
+    bins = W / 2 + 1;
+  }
+  int num_segments = W > 0 ? 1 + (N - W) / (W / 2) : 0;
+  if (num_segments == 0) {
+    return -1;
+  }
+  if (num_threads > num_segments) {
+    num_threads = num_segments;
+  }
+
+  double* hann = run_alloc(W * sizeof(double));
+  double energy = 0;
+  for (int i = 0; i < W; i++) {
+    hann[i] = 0.5 - 0.5 * cos(2 * M_PI * i / W);
+    energy += hann[i] * hann[i];
+  }
+
+  pthread_t* tid = run_alloc(num_threads * sizeof(pthread_t));
+  welch_inputs* thread_inputs = run_alloc(num_threads * sizeof(welch_inputs));
+  int row = (bins + SLOT_ROUND - 1) / SLOT_ROUND * SLOT_ROUND;
+  double* psd = run_alloc((long)num_threads * row * sizeof(double));
+  int frame_size = (W + 2 * bins + SLOT_ROUND - 1) / SLOT_ROUND * SLOT_ROUND;
+  double* frames = run_alloc((long)num_threads * frame_size * sizeof(double));
+
+  int per_thread = (num_segments + num_threads - 1) / num_threads;
+
+  for (int i = 0; i < num_threads; i++) {
+    int first = i * per_thread < num_segments ? i * per_thread : num_segments;
+    thread_inputs[i].processor = (first_processor + i) % num_processors;
+    thread_inputs[i].sig = sig;
+    thread_inputs[i].dc = dc;
+    thread_inputs[i].segment = W;
+    thread_inputs[i].hann = hann;
+    thread_inputs[i].first = first;
+    thread_inputs[i].num = num_segments - first < per_thread ? num_segments - first : per_thread;
+    thread_inputs[i].psd = psd + (long)i * row;
+    thread_inputs[i].frame = frames + (long)i * frame_size;
+    if (pthread_create(&(tid[i]), NULL, welch_worker, &(thread_inputs[i])) != 0) {
+      perror("Failed to start thread");
+      exit(-1);
+    }
+  }
+
+  for (int i = 0; i < num_threads; i++) {
+    if (pthread_join(tid[i], NULL) != 0) {
+      perror("join failed");
+      exit(-1);
+    }
+  }
+
+  // average, and fold the bins into bands: the inner bins count twice
+  // (negative frequencies), 1 / W for Parseval, 1 / energy for the window
+  double scale = 1.0 / ((double)num_segments * W * energy);
+  for (int b = 0; b < num_bands; b++) {
+    band_power[b] = 0;
+  }
+  for (int k = 0; k < bins; k++) {
+    double p = 0;
+    for (int i = 0; i < num_threads; i++) {
+      p += psd[(long)i * row + k];
+    }
+    int b = (int)(k * sig->Fs / W / bandwidth);
+    int twice = k > 0 && 2 * k < W;
+    band_power[b < num_bands ? b : num_bands - 1] += (twice ? 2 : 1) * p * scale;
+  }
+
+  run_free(frames);
+  run_free(psd);
+  run_free(thread_inputs);
+  run_free(tid);
+  run_free(hann);
+
+  return 0;
+}
+
+/*
+ * Pre-screen.  A band's output energy over all N + order outputs of the
+ * aperiodic convolution is sum_{|m| <= order} r_h[m] r_x[m], the
+ * autocorrelations of the filter and of the signal at lags up to the
+ * order.  r_x is gathered Bartlett style: segments of S = P - order
+ * samples are transformed at P points, each along with itself extended by
+ * the next order samples, and the cross spectra summed (each thread over
+ * a contiguous run of segments into its own padded row, the rows added in
+ * thread order).  Transformed back, lags 0..order are exactly r_x, since
+ * no product wraps around.  Its even extension transforms to the
+ * spectrum R, and a band's energy is sum_k |H_k|^2 R_k / P from one P
+ * point transform of the filter.  So memory is O(P) and the signal costs
+ * O(N log P) however long it is, each band O(P log P); P is a small
+ * multiple of the order.  The energy is exact but for rounding, which
+ * the bounds allow for either side of it.  The scan only keeps outputs
+ * 0..N-1; the other order, the filter running off the end of the signal,
+ * are computed directly and taken off.
+ */
+
+#define PRESCREEN_SEGMENT_PER_TAP 8   // P >= this times order + 1
+
+typedef struct acf_inputs {
+  int processor;
+  signal* sig;
+  double dc;
+  int P;                // transform size
+  int S;                // new samples per segment
+  int order;
+  long first;           // segments first .. first + num - 1
+  long num;
+  double* row;          // this thread's summed cross spectrum, P / 2 + 1 bins
+  double* frame;        // scratch: two segments of P, then their spectra
+} __attribute__((aligned(CACHE_LINE))) acf_inputs;
+
+typedef struct prescreen_inputs {
+  int id;
+  int num_threads;
+  int processor;
+  signal* sig;
+  int order;
+  double bandwidth;
+  int num_bands;
+  int P;
+  double* spectrum;     // R, P / 2 + 1 reals
+  double dc;
+  double r0;            // r_x[0], the signal's energy
+  double* lower;
+  double* upper;
+  double* frame;        // scratch: order + 1 coefficients, then P doubles
+                        // and P / 2 + 1 complex bins
+} __attribute__((aligned(CACHE_LINE))) prescreen_inputs;
+
+// complex bins of a P point transform, padded to whole cache lines
+static int spectrum_stride(int P) {
+  return (2 * (P / 2 + 1) + SLOT_ROUND - 1) / SLOT_ROUND * SLOT_ROUND;
+}
+
+static void* acf_worker(void* arg) {
+  acf_inputs* input = (acf_inputs*)arg;
+
+  pin(input->processor);
+
+  int P = input->P;
+  int S = input->S;
+  int bins = P / 2 + 1;
+  long N = input->sig->num_samples;
+  double* x = input->sig->data;
+  double* a = input->frame;
+  double* b = a + P;
+  fftw_complex* A = (fftw_complex*)(b + P);
+  fftw_complex* B = (fftw_complex*)(b + P + spectrum_stride(P));
+  fftw_plan plan = fft_plan(P, FFT_R2C, a, A);
+  fftw_complex* row = (fftw_complex*)input->row;
+
+  for (int k = 0; k < bins; k++) {
+    row[k][0] = 0;
+    row[k][1] = 0;
+  }
+
+  for (long seg = input->first; seg < input->first + input->num; seg++) {
+    long start = seg * S;
+    for (int i = 0; i < P; i++) {
+      double v = start + i < N ? x[start + i] - input->dc : 0;
+      a[i] = i < S ? v : 0;
+      b[i] = i < S + input->order ? v : 0;
+    }
+    fftw_execute_dft_r2c(plan, a, A);
+    fftw_execute_dft_r2c(plan, b, B);
+    // conj(A) B: the correlation of the segment with its extension
+    for (int k = 0; k < bins; k++) {
+      row[k][0] += A[k][0] * B[k][0] + A[k][1] * B[k][1];
+      row[k][1] += A[k][0] * B[k][1] - A[k][1] * B[k][0];
+    }
+  }
+
+  pthread_exit(NULL);
+}
+
+static void* prescreen_worker(void* arg) {
+  prescreen_inputs* input = (prescreen_inputs*)arg;
+
+  pin(input->processor);
+
+  int P = input->P;
+  double* h = input->frame;
+  double* padded = h + (input->order + 1 + SLOT_ROUND - 1) / SLOT_ROUND * SLOT_ROUND;
+  fftw_complex* H = (fftw_complex*)(padded + P);
+  fftw_plan plan = fft_plan(P, FFT_R2C, padded, H);
+
+  for (int b = input->id; b < input->num_bands; b += input->num_threads) {
+    design_band_pass(&design, input->sig->Fs,
+                     BAND_LOW(b, input->bandwidth), BAND_HIGH(b, input->bandwidth),
+                     input->order, h);
+    double gain = 0;            // sum |h|, a bound on |H|
+    for (int j = 0; j <= input->order; j++) {
+      padded[j] = h[j];
+      gain += fabs(h[j]);
+    }
+    for (int j = input->order + 1; j < P; j++) {
+      padded[j] = 0;
+    }
+    fftw_execute_dft_r2c(plan, padded, H);
+
+    // the inner bins stand for their negative frequency twins too
+    double energy = 0;
+    for (int k = 0; k <= P / 2; k++) {
+      double g = H[k][0] * H[k][0] + H[k][1] * H[k][1];
+      energy += (k > 0 && k < P / 2 ? 2 : 1) * g * input->spectrum[k];
+    }
+    energy /= P;
+
+    long N = input->sig->num_samples;
+    double* x = input->sig->data;
+    double tail = 0;
+    for (long n = N; n < N + input->order; n++) {
+      double y = 0;
+      for (long j = n - N + 1; j <= input->order && j <= n; j++) {
+        y += h[j] * (x[n - j] - input->dc);
+      }
+      tail += y * y;
+    }
+    double slack = 1e-9 * input->r0 * gain * gain;
+    input->upper[b] = fmax(0.0, energy - tail + slack) / N;
+    input->lower[b] = fmax(0.0, energy - tail - slack) / N;
+  }
+
+  pthread_exit(NULL);
+}
+
+int scan_prescreen(signal* sig, double dc, int filter_order, double bandwidth,
+                   int num_bands, double* lower, double* upper,
+                   int num_threads, int first_processor, int num_processors) {
+
+  long N = sig->num_samples;
+  int P = FFT_BLOCK;
+  while (P < PRESCREEN_SEGMENT_PER_TAP * (filter_order + 1)) {
+    P *= 2;
+  }
+  int S = P - filter_order;
+  int bins = P / 2 + 1;
+  int stride = spectrum_stride(P);
+  long num_segments = (N + S - 1) / S;
+  if (num_segments == 0) {
+    return -1;
+  }
+
+  // the signal's autocorrelation, segment by segment
+  int acf_threads = num_threads < num_segments ? num_threads : num_segments;
+  pthread_t* tid = run_alloc(num_threads * sizeof(pthread_t));
+  acf_inputs* acf = run_alloc(acf_threads * sizeof(acf_inputs));
+  double* rows = run_alloc((long)acf_threads * stride * sizeof(double));
+  int acf_frame = 2 * P + 2 * stride;
+  double* acf_frames = run_alloc((long)acf_threads * acf_frame * sizeof(double));
+  long per_thread = (num_segments + acf_threads - 1) / acf_threads;
+
+  for (int i = 0; i < acf_threads; i++) {
+    long first = i * per_thread < num_segments ? i * per_thread : num_segments;
+    acf[i].processor = (first_processor + i) % num_processors;
+    acf[i].sig = sig;
+    acf[i].dc = dc;
+    acf[i].P = P;
+    acf[i].S = S;
+    acf[i].order = filter_order;
+    acf[i].first = first;
+    acf[i].num = num_segments - first < per_thread ? num_segments - first : per_thread;
+    acf[i].row = rows + (long)i * stride;
+    acf[i].frame = acf_frames + (long)i * acf_frame;
+    if (pthread_create(&(tid[i]), NULL, acf_worker, &(acf[i])) != 0) {
+      perror("Failed to start thread");
+      exit(-1);
+    }
+  }
+  for (int i = 0; i < acf_threads; i++) {
+    if (pthread_join(tid[i], NULL) != 0) {
+      perror("join failed");
+      exit(-1);
+    }
+  }
+
+  // rows added in thread order, back to lags, and the even extension of
+  // lags 0..order out to the spectrum R
+  fftw_complex* Z = (fftw_complex*)rows;
+  for (int i = 1; i < acf_threads; i++) {
+    fftw_complex* r = (fftw_complex*)(rows + (long)i * stride);
+    for (int k = 0; k < bins; k++) {
+      Z[k][0] += r[k][0];
+      Z[k][1] += r[k][1];
+    }
+  }
+  double* lags = acf_frames;
+  fftw_complex* R = (fftw_complex*)(acf_frames + 2 * P);
+  fftw_execute_dft_c2r(fft_plan(P, FFT_C2R, Z, lags), Z, lags);
+  double* even = acf_frames + P;
+  for (int m = 0; m < P; m++) {
+    even[m] = 0;
+  }
+  even[0] = lags[0] / P;
+  for (int m = 1; m <= filter_order; m++) {
+    even[m] = even[P - m] = lags[m] / P;
+  }
+  fftw_execute_dft_r2c(fft_plan(P, FFT_R2C, even, R), even, R);
+  double* spectrum = run_alloc(bins * sizeof(double));
+  for (int k = 0; k < bins; k++) {
+    spectrum[k] = R[k][0];
+  }
+  double r0 = even[0];
+
+  if (num_threads > num_bands) {
+    num_threads = num_bands;
+  }
+  prescreen_inputs* thread_inputs = run_alloc(num_threads * sizeof(prescreen_inputs));
+  int frame_size = (filter_order + 1 + SLOT_ROUND - 1) / SLOT_ROUND * SLOT_ROUND + P + stride;
+  double* frames = run_alloc((long)num_threads * frame_size * sizeof(double));
+
+  for (int i = 0; i < num_threads; i++) {
+    thread_inputs[i].id = i;
+    thread_inputs[i].num_threads = num_threads;
+    thread_inputs[i].processor = (first_processor + i) % num_processors;
+    thread_inputs[i].sig = sig;
+    thread_inputs[i].order = filter_order;
+    thread_inputs[i].bandwidth = bandwidth;
+    thread_inputs[i].num_bands = num_bands;
+    thread_inputs[i].P = P;
+    thread_inputs[i].spectrum = spectrum;
+    thread_inputs[i].dc = dc;
+    thread_inputs[i].r0 = r0;
+    thread_inputs[i].lower = lower;
+    thread_inputs[i].upper = upper;
+    thread_inputs[i].frame = frames + (long)i * frame_size;
+    if (pthread_create(&(tid[i]), NULL, prescreen_worker, &(thread_inputs[i])) != 0) {
+      perror("Failed to start thread");
+      exit(-1);
+    }
+  }
+
+  for (int i = 0; i < num_threads; i++) {
+    if (pthread_join(tid[i], NULL) != 0) {
+      perror("join failed");
+      exit(-1);
+    }
+  }
+
+  run_free(frames);
+  run_free(thread_inputs);
+  run_free(spectrum);
+  run_free(acf_frames);
+  run_free(rows);
+  run_free(acf);
+  run_free(tid);
+
+  return 0;
+}
+
+
+/*
+ * Tones.  Goertzel over contiguous chunks of the signal, one per thread;
+ * each partial transform is referenced to the start of the signal, so
+ * they just add up, in chunk order.
+ */
+
+typedef struct tone_inputs {
+  int processor;
+  double* data;
+  long first;
+  long num;
+  double dc;
+  int num_targets;
+  double* omega;
+  double* re;           // this thread's partial transform
+  double* im;
+} __attribute__((aligned(CACHE_LINE))) tone_inputs;
+
+static void* tone_worker(void* arg) {
+  tone_inputs* input = (tone_inputs*)arg;
+
+  pin(input->processor);
+
+  for (int t = 0; t < input->num_targets; t++) {
+    input->re[t] = 0;
+    input->im[t] = 0;
+  }
+  goertzel_bank(input->num, input->data, input->dc, input->first,
+                input->num_targets, input->omega, input->re, input->im);
+
+  pthread_exit(NULL);
+}
+
+void scan_tones(signal* sig, double dc, int num_targets, double* freqs,
+                double* tone_power,
+                int num_threads, int first_processor, int num_processors) {
+
+  pthread_t* tid = run_alloc(num_threads * sizeof(pthread_t));
+  tone_inputs* thread_inputs = run_alloc(num_threads * sizeof(tone_inputs));
+  double* omega = run_alloc(num_targets * sizeof(double));
+  int row = (2 * num_targets + SLOT_ROUND - 1) / SLOT_ROUND * SLOT_ROUND;
+  double* partial = run_alloc((long)num_threads * row * sizeof(double));
+
+  for (int t = 0; t < num_targets; t++) {
+    omega[t] = 2 * M_PI * freqs[t] / sig->Fs;
+  }
+
+  long per_thread = ((long)sig->num_samples + num_threads - 1) / num_threads;
+
+  for (int i = 0; i < num_threads; i++) {
+    long first = i * per_thread < sig->num_samples ? i * per_thread : sig->num_samples;
+    long last  = first + per_thread < sig->num_samples ? first + per_thread : sig->num_samples;
+    thread_inputs[i].processor = (first_processor + i) % num_processors;
+    thread_inputs[i].data = sig->data + first;
+    thread_inputs[i].first = first;
+    thread_inputs[i].num = last - first;
+    thread_inputs[i].dc = dc;
+    thread_inputs[i].num_targets = num_targets;
+    thread_inputs[i].omega = omega;
+    thread_inputs[i].re = partial + (long)i * row;
+    thread_inputs[i].im = partial + (long)i * row + num_targets;
+    if (pthread_create(&(tid[i]), NULL, tone_worker, &(thread_inputs[i])) != 0) {
+      perror("Failed to start thread");
+      exit(-1);
+    }
+  }
+
+  for (int i = 0; i < num_threads; i++) {
+    if (pthread_join(tid[i], NULL) != 0) {
+      perror("join failed");
+      exit(-1);
+    }
+  }
+
+  for (int t = 0; t < num_targets; t++) {
+    double re = 0;
+    double im = 0;
+    for (int i = 0; i < num_threads; i++) {
+      re += thread_inputs[i].re[t];
+      im += thread_inputs[i].im[t];
+    }
+    tone_power[t] = goertzel_power(sig->num_samples, omega[t], re, im);
+  }
+
+  run_free(partial);
+  run_free(omega);
+  run_free(thread_inputs);
+  run_free(tid);
+}
+
+
+/*
+ * Baseband.  The front end (heterodyne_decimate) runs first, each thread
+ * making a contiguous piece of the decimated stream.  Then the bands are
+ * dealt out round-robin as in scan_bands: each is mixed from its offset
+ * in the baseband down to 0 Hz and low pass filtered, I and Q separately
+ * by the real power kernels, at the reduced rate and a proportionally
+ * reduced order.  The mixing is a MIX_BLOCK at a time, after the last
+ * order mixed samples of the block before, so a thread's scratch is
+ * O(order + MIX_BLOCK) however long the capture.
+ */
+
+#define MIX_BLOCK 1024  // samples mixed and filtered at a time
+
+typedef struct baseband_inputs {
+  int id;
+  int num_threads;
+  int processor;
+  signal* sig;          // the full rate input, for the front end
+  double dc;
+  double omega0;
+  int stages;
+  long first;           // front end: outputs first .. first + num - 1
+  long num;
+  double* re;           // the baseband stream
+  double* im;
+  long length;
+  double Fs;            // its rate
+  double f0;            // and what it is centered on
+  double bandwidth;
+  int order;            // band filters: order, coefficients, scratch
+  double* coeffs;
+  double* mixed;        // 2 * (order + MIX_BLOCK) doubles
+  nco* osc;
+  int* bands;
+  int num_scan;
+  double* slot;
+} __attribute__((aligned(CACHE_LINE))) baseband_inputs;
+
+static void* frontend_worker(void* arg) {
+  baseband_inputs* input = (baseband_inputs*)arg;
+
+  pin(input->processor);
+
+  if (heterodyne_decimate(input->sig->num_samples, input->sig->data, input->dc,
+                          input->omega0, input->stages, input->first, input->num,
+                          input->re + input->first, input->im + input->first)) {
+    perror("Front end failed");
+    exit(-1);
+  }
+
+  pthread_exit(NULL);
+}
+
+static void* baseband_worker(void* arg) {
+  baseband_inputs* input = (baseband_inputs*)arg;
+
+  pin(input->processor);
+
+  long L = input->length;
+  int order = input->order;
+  double* mr = input->mixed;                 // order of history, then a block
+  double* mi = input->mixed + order + MIX_BLOCK;
+
+  int mine = 0;
+  for (int k = input->id; k < input->num_scan; k += input->num_threads) {
+    int band = input->bands[k];
+    double low  = BAND_LOW(band, input->bandwidth);
+    double high = BAND_HIGH(band, input->bandwidth);
+    double omega = 2 * M_PI * ((low + high) / 2 - input->f0) / input->Fs;
+
+    // band center to 0 Hz
+    nco_init(input->osc, omega);
+
+    generate_low_pass(input->Fs, (high - low) / 2, order, input->coeffs);
+    hamming_window(order, input->coeffs);
+
+    // the filters start from zeros, as on the whole stream
+    memset(mr, 0, order * sizeof(double));
+    memset(mi, 0, order * sizeof(double));
+    double sum = 0;
+    for (long b = 0; b < L; b += MIX_BLOCK) {
+      long n = L - b < MIX_BLOCK ? L - b : MIX_BLOCK;
+      nco_mix(input->osc, b, n, input->re, input->im, 1, 0, 0, mr + order, mi + order);
+
+      double power_re, power_im;
+      convolve_continue_and_compute_power(n, mr + order, order, input->coeffs, &power_re);
+      convolve_continue_and_compute_power(n, mi + order, order, input->coeffs, &power_im);
+      sum += (power_re + power_im) * n;
+
+      memmove(mr, mr + n, order * sizeof(double));
+      memmove(mi, mi + n, order * sizeof(double));
+    }
+
+    // the baseband holds the positive frequency half of the real signal
+    // at half its amplitude: double to get the real band's power back
+    input->slot[mine++] = 2 * sum / L;
+  }
+
+  pthread_exit(NULL);
+}
+
+void scan_baseband(signal* sig, double dc, double f0, int stages,
+                   int filter_order, double bandwidth,
+                   double* band_power, int* bands, int num_scan,
+                   int num_threads, int first_processor, int num_processors) {
+
+  long N = sig->num_samples;
+  long L = frontend_length(N, stages);
+  int order = (filter_order >> stages) & ~0x1;
+  if (order < 2) {
+    order = 2;
+  }
+
+  pthread_t* tid = run_alloc(num_threads * sizeof(pthread_t));
+  baseband_inputs* thread_inputs = run_alloc(num_threads * sizeof(baseband_inputs));
+  double* stream = run_alloc(2 * L * sizeof(double));
+  int per_thread = (num_scan + num_threads - 1) / num_threads;
+  int stride = (per_thread + SLOT_ROUND - 1) / SLOT_ROUND * SLOT_ROUND;
+  double* slots = run_alloc(((long)num_threads * stride + SLOT_ROUND) * sizeof(double));
+  int coeff_stride = (order + 1 + SLOT_ROUND - 1) / SLOT_ROUND * SLOT_ROUND;
+  double* coeffs = run_alloc((long)num_threads * coeff_stride * sizeof(double));
+  int mixed_stride = (2 * (order + MIX_BLOCK) + SLOT_ROUND - 1) / SLOT_ROUND * SLOT_ROUND;
+  double* mixed = run_alloc((long)num_threads * mixed_stride * sizeof(double));
+  nco* oscs = run_alloc((long)num_threads * sizeof(nco));
+
+  long per_thread_out = (L + num_threads - 1) / num_threads;
+
+  for (int i = 0; i < num_threads; i++) {
+    long first = i * per_thread_out < L ? i * per_thread_out : L;
+    long last  = first + per_thread_out < L ? first + per_thread_out : L;
+    baseband_inputs* in = &thread_inputs[i];
+    in->id = i;
+    in->num_threads = num_threads;
+    in->processor = (first_processor + i) % num_processors;
+    in->sig = sig;
+    in->dc = dc;
+    in->omega0 = 2 * M_PI * f0 / sig->Fs;
+    in->stages = stages;
+    in->first = first;
+    in->num = last - first;
+    in->re = stream;
+    in->im = stream + L;
+    in->length = L;
+    in->Fs = sig->Fs / (1L << stages);
+    in->f0 = f0;
+    in->bandwidth = bandwidth;
+    in->order = order;
+    in->coeffs = coeffs + (long)i * coeff_stride;
+    in->mixed = mixed + (long)i * mixed_stride;
+    in->osc = &oscs[i];
+    in->bands = bands;
+    in->num_scan = num_scan;
+    in->slot = slots + (long)i * stride;
+    if (pthread_create(&(tid[i]), NULL, frontend_worker, in) != 0) {
+      perror("Failed to start thread");
+      exit(-1);
+    }
+  }
+  for (int i = 0; i < num_threads; i++) {
+    if (pthread_join(tid[i], NULL) != 0) {
+      perror("join failed");
+      exit(-1);
+    }
+  }
+
+  for (int i = 0; i < num_threads; i++) {
+    if (pthread_create(&(tid[i]), NULL, baseband_worker, &(thread_inputs[i])) != 0) {
+      perror("Failed to start thread");
+      exit(-1);
+    }
+  }
+  for (int i = 0; i < num_threads; i++) {
+    if (pthread_join(tid[i], NULL) != 0) {
+      perror("join failed");
+      exit(-1);
+    }
+    int mine = 0;
+    for (int k = i; k < num_scan; k += num_threads) {
+      band_power[bands[k]] = thread_inputs[i].slot[mine++];
+    }
+  }
+
+  run_free(oscs);
+  run_free(mixed);
+  run_free(coeffs);
+  run_free(slots);
+  run_free(stream);
+  run_free(thread_inputs);
+  run_free(tid);
+}
+
+
+/*
+ * AM demodulation.  Contiguous pieces of the output, one per thread, each
+ * made DEMOD_CHUNK outputs at a time so the scratch stays small.
+ */
+
+#define DEMOD_CHUNK 65536
+
+typedef struct demod_inputs {
+  int processor;
+  signal* sig;
+  double dc;
+  am_demod* am;
+  long first;
+  long num;
+  double* out;
+} __attribute__((aligned(CACHE_LINE))) demod_inputs;
+
+static void* demod_worker(void* arg) {
+  demod_inputs* input = (demod_inputs*)arg;
+
+  pin(input->processor);
+
+  for (long b = 0; b < input->num; b += DEMOD_CHUNK) {
+    long n = input->num - b < DEMOD_CHUNK ? input->num - b : DEMOD_CHUNK;
+    if (am_demodulate(input->am, input->sig->num_samples, input->sig->data, input->dc,
+                      input->first + b, n, input->out + input->first + b)) {
+      perror("Demodulation failed");
+      exit(-1);
+    }
+  }
+
+  pthread_exit(NULL);
+}
+
+void scan_demodulate(signal* sig, double dc, am_demod* am, double* out,
+                     int num_threads, int first_processor, int num_processors) {
+
+  pthread_t* tid = run_alloc(num_threads * sizeof(pthread_t));
+  demod_inputs* thread_inputs = run_alloc(num_threads * sizeof(demod_inputs));
+
+  long L = am_demod_length(am, sig->num_samples);
+  long per_thread = (L + num_threads - 1) / num_threads;
+
+  for (int i = 0; i < num_threads; i++) {
+    long first = i * per_thread < L ? i * per_thread : L;
+    long last  = first + per_thread < L ? first + per_thread : L;
+    thread_inputs[i].processor = (first_processor + i) % num_processors;
+    thread_inputs[i].sig = sig;
+    thread_inputs[i].dc = dc;
+    thread_inputs[i].am = am;
+    thread_inputs[i].first = first;
+    thread_inputs[i].num = last - first;
+    thread_inputs[i].out = out;
+    if (pthread_create(&(tid[i]), NULL, demod_worker, &(thread_inputs[i])) != 0) {
+      perror("Failed to start thread");
+      exit(-1);
+    }
+  }
+
+  for (int i = 0; i < num_threads; i++) {
+    if (pthread_join(tid[i], NULL) != 0) {
+      perror("join failed");
+      exit(-1);
+    }
+  }
+
+  run_free(thread_inputs);
+  run_free(tid);
+}
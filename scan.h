@@ -0,0 +1,111 @@
+#ifndef _scan
+#define _scan
+
+#include "signal.h"
+#include "filter.h"
+
+/*
+ *  Multithreaded band pass filter bank scan
+ *
+ *  Filters the bands listed in bands[0..num_scan) of sig less its DC
+ *  component dc (sig itself is not modified), band b covering
+ *  BAND_LOW(b, bandwidth)..BAND_HIGH(b, bandwidth), and writes the power of
+ *  each into band_power[b].  The list is dealt out round-robin to
+ *  num_threads threads, thread i pinned to processor
+ *  (first_processor + i) % num_processors.
+ *
+ *  Programs using this must be built with -pthread.
+ */
+void scan_bands(signal* sig, double dc, int filter_order, double bandwidth,
+                double* band_power, int* bands, int num_scan,
+                int num_threads, int first_processor, int num_processors);
+
+// scan_bands for a complex (I/Q) sig less dc_i + j dc_q, the bands
+// spanning -Fs/2..Fs/2 (report_band_origin(-Fs/2)): each band's center is
+// mixed down to 0 Hz and a Hamming low pass of half the band width run on
+// I and Q (convolve_iq_and_compute_power, or its FFT equivalent with the
+// FFT engine).  The design, the IIR engine and sampling don't apply.
+void scan_bands_iq(signal* sig, double dc_i, double dc_q, int filter_order, double bandwidth,
+                   double* band_power, int* bands, int num_scan,
+                   int num_threads, int first_processor, int num_processors);
+
+// scan_bands by sampling: each band's power estimated from about one
+// filter output in stride (convolve_dc_and_estimate_power, direct
+// convolution whatever the engine), band_error[b] the half width of its
+// confidence interval
+void scan_estimate(signal* sig, double dc, int filter_order, double bandwidth,
+                   int stride, double* band_power, double* band_error,
+                   int* bands, int num_scan,
+                   int num_threads, int first_processor, int num_processors);
+
+// signal_statistics of sig, computed by num_threads threads pinned the
+// same way, each taking a contiguous chunk
+void scan_statistics(signal* sig, signal_stats* stats,
+                     int num_threads, int first_processor, int num_processors);
+// Same for a complex sig, I and Q each on their own (iq_signal_statistics)
+void scan_iq_statistics(signal* sig, signal_stats* i_stats, signal_stats* q_stats,
+                        int num_threads, int first_processor, int num_processors);
+
+// Welch power spectral density of sig less dc, its bins summed into the
+// num_bands bands of bandwidth: a cheap estimate of the whole band_power
+// table at once.  Half overlapping Hann windowed segments of
+// welch_segment(num_bands) samples, split over num_threads pinned threads.
+// Returns -1 if the signal is too short.
+#define WELCH_BINS_PER_BAND 8
+
+int  welch_segment(int num_bands);
+int  scan_welch(signal* sig, double dc, int num_bands, double bandwidth,
+                double* band_power,
+                int num_threads, int first_processor, int num_processors);
+
+// Guaranteed bounds lower[b] <= band_power[b] <= upper[b] on what
+// scan_bands would give for all num_bands bands (the current design at
+// filter_order), from the signal's autocorrelation up to the order
+// (segment by segment, small transforms, over num_threads threads) and
+// one small transform per filter: about one band's filtering for the
+// signal, whatever num_bands, in memory independent of its length.  The
+// bounds only allow for rounding.  Returns -1 for an empty signal.
+int  scan_prescreen(signal* sig, double dc, int filter_order, double bandwidth,
+                    int num_bands, double* lower, double* upper,
+                    int num_threads, int first_processor, int num_processors);
+
+// Power (goertzel_power) of the tones at num_targets frequencies freqs[]
+// (Hz) over the whole signal less dc, by a Goertzel bank over num_threads
+// contiguous chunks of the signal
+void scan_tones(signal* sig, double dc, int num_targets, double* freqs,
+                double* tone_power,
+                int num_threads, int first_processor, int num_processors);
+
+// scan_bands for bands around f0 (Hz) only, through the front end: sig
+// less dc is mixed down to f0 and decimated by 2^stages (see
+// heterodyne_decimate), and the bands are filtered at that rate with
+// filters of filter_order / 2^stages, so each band costs about
+// 2 / 4^stages of a full rate one (I and Q, at 1 / 2^stages the samples
+// and the taps).  The bands must lie within the
+// frontend_stages() width around f0.
+void scan_baseband(signal* sig, double dc, double f0, int stages,
+                   int filter_order, double bandwidth,
+                   double* band_power, int* bands, int num_scan,
+                   int num_threads, int first_processor, int num_processors);
+
+// AM demodulation (am_demodulate) of all of sig less dc into out, which
+// must have room for am_demod_length(am, sig->num_samples) doubles, the
+// output split into contiguous pieces over num_threads threads
+void scan_demodulate(signal* sig, double dc, am_demod* am, double* out,
+                     int num_threads, int first_processor, int num_processors);
+
+typedef enum {SCAN_DIRECT, SCAN_FFT, SCAN_IIR} scan_engine;
+
+// How scan_bands filters: direct convolution (default) or FFT
+// overlap-save with cached plans (see fft.h).  With the FFT engine and
+// fewer bands than threads, the spare threads run inside the transforms.
+// SCAN_IIR replaces the FIR filters with iir_bank_power's biquads
+// (filter_order and the design are ignored), each thread's bands in one
+// pass: detection grade, not measurement grade.
+void scan_use_engine(scan_engine e);
+
+// How scan_bands designs its filters (see design_band_pass); the default
+// is DESIGN_HAMMING.  scan_baseband's low passes stay Hamming.
+void scan_use_design(filter_spec* spec);
+
+#endif
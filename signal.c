@@ -1,11 +1,14 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <math.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include "signal.h"
+#include "arena.h"
 
 
 void free_signal(signal* sig) {
@@ -14,7 +17,7 @@ void free_signal(signal* sig) {
       if (sig->map_fd >= 0) {
         unmap_binary_format_signal(sig);
       } else {
-        free(sig->data);
+        run_free(sig->data);
       }
     }
     free(sig);
@@ -30,16 +33,14 @@ signal* allocate_signal(int numsamples, double Fs, int for_mapping) {
   }
 
   sig->num_samples = numsamples;
+  sig->iq     = 0;
   sig->Fs     = Fs;
   sig->data   = 0;
   sig->map_fd = -1;
 
   if (!for_mapping) {
-    if (!(sig->data = (double*)malloc(sizeof(double) * sig->num_samples))) {
-      perror("Not enough memory");
-      free_signal(sig);
-      return 0;
-    }
+    // from the run arena if there is one, aligned for the vector kernels
+    sig->data = (double*)run_alloc(sizeof(double) * (long)sig->num_samples);
   }
 
   return sig;
@@ -96,7 +97,7 @@ int save_text_format_signal(char* file, signal* sig) {
     return -1;
   }
 
-  for (int i = 0; i < sig->num_samples; i++) {
+  for (long i = 0; i < SIGNAL_VALUES(sig); i++) {
     fprintf(f,"%lf\n",sig->data[i]);
   }
 
@@ -177,8 +178,8 @@ int save_binary_format_signal(char* file, signal* sig) {
 
   lseek(fd,OFFSET_TO_DATA,SEEK_SET);
 
-  int left  = sig->num_samples * sizeof(double); // number of bytes left to read
-  char* cur = (char*)(sig->data);  // location of next read
+  long left = SIGNAL_VALUES(sig) * sizeof(double); // number of bytes left to write
+  char* cur = (char*)(sig->data);  // location of next write
   int thiswrite;
 
   while (left > 0) {
@@ -200,7 +201,7 @@ int save_binary_format_signal(char* file, signal* sig) {
 
 
 
-signal* map_binary_format_signal(char* file) {
+static signal* map_signal(char* file, int private) {
 
   int num = get_num_samples_from_binary_file(file, 1);
   if (num <= 0) {
@@ -208,7 +209,7 @@ signal* map_binary_format_signal(char* file) {
   }
 
   int fd;
-  if ((fd = open(file, O_RDWR)) < 0) {
+  if ((fd = open(file, private ? O_RDONLY : O_RDWR)) < 0) {
     perror("Cannot open file");
     return 0;
   }
@@ -224,7 +225,7 @@ signal* map_binary_format_signal(char* file) {
   sig->data = mmap(0,                  // map anywhere
                    num * sizeof(double), // this number of bytes
                    PROT_READ | PROT_WRITE, // Read/Write
-                   MAP_SHARED, // flush writes to file
+                   private ? MAP_PRIVATE : MAP_SHARED, // flush writes to file?
                    fd, // this file
                    OFFSET_TO_DATA);
 
@@ -240,6 +241,14 @@ signal* map_binary_format_signal(char* file) {
   return sig;
 }
 
+signal* map_binary_format_signal(char* file) {
+  return map_signal(file, 0);
+}
+
+signal* map_private_binary_format_signal(char* file) {
+  return map_signal(file, 1);
+}
+
 
 int unmap_binary_format_signal(signal* sig) {
   if (sig->map_fd < 0) {
@@ -247,7 +256,7 @@ int unmap_binary_format_signal(signal* sig) {
     return -1;
   }
 
-  munmap(sig->data, sig->num_samples * sizeof(double));
+  munmap(sig->data, SIGNAL_VALUES(sig) * sizeof(double));
   sig->data = 0;
   close(sig->map_fd);
   sig->map_fd = -1;
@@ -255,3 +264,362 @@ int unmap_binary_format_signal(signal* sig) {
   return 0;
 }
 
+
+int signal_to_iq(signal* sig) {
+  if (sig->iq || (sig->num_samples & 0x1)) {
+    return -1;
+  }
+  sig->num_samples /= 2;
+  sig->iq = 1;
+  return 0;
+}
+
+
+/*
+ * Statistics.  Each block of STATS_BLOCK samples is handled in cache with
+ * STATS_LANES independent accumulators (which the compiler turns into
+ * vector registers): a sum and min/max pass, then the squared deviations
+ * from the block mean.  Blocks are combined pairwise with Chan's update,
+ * so rounding error grows with log(num) instead of num.
+ */
+
+#define STATS_BLOCK 1024
+#define STATS_LANES 8
+
+static void block_statistics(double* data, long num, signal_stats* st) {
+
+  double sum[STATS_LANES], lo[STATS_LANES], hi[STATS_LANES];
+  for (int l = 0; l < STATS_LANES; l++) {
+    sum[l] = 0;
+    lo[l] = hi[l] = data[0];
+  }
+
+  long i;
+  for (i = 0; i + STATS_LANES <= num; i += STATS_LANES) {
+    for (int l = 0; l < STATS_LANES; l++) {
+      double x = data[i + l];
+      sum[l] += x;
+      lo[l] = x < lo[l] ? x : lo[l];
+      hi[l] = x > hi[l] ? x : hi[l];
+    }
+  }
+  for (; i < num; i++) {
+    double x = data[i];
+    sum[0] += x;
+    lo[0] = x < lo[0] ? x : lo[0];
+    hi[0] = x > hi[0] ? x : hi[0];
+  }
+
+  double s = 0;
+  st->min = lo[0];
+  st->max = hi[0];
+  for (int l = 0; l < STATS_LANES; l++) {
+    s += sum[l];
+    st->min = lo[l] < st->min ? lo[l] : st->min;
+    st->max = hi[l] > st->max ? hi[l] : st->max;
+  }
+  double mean = s / num;
+
+  double dev[STATS_LANES] = {0};
+  for (i = 0; i + STATS_LANES <= num; i += STATS_LANES) {
+    for (int l = 0; l < STATS_LANES; l++) {
+      double d = data[i + l] - mean;
+      dev[l] += d * d;
+    }
+  }
+  for (; i < num; i++) {
+    double d = data[i] - mean;
+    dev[0] += d * d;
+  }
+
+  double m2 = 0;
+  for (int l = 0; l < STATS_LANES; l++) {
+    m2 += dev[l];
+  }
+
+  st->count = num;
+  st->mean  = mean;
+  st->power = m2 / num;
+}
+
+void merge_signal_statistics(signal_stats* into, signal_stats* other) {
+
+  if (other->count == 0) {
+    return;
+  }
+  if (into->count == 0) {
+    *into = *other;
+    return;
+  }
+
+  double n  = into->count + other->count;
+  double na = into->count / n;
+  double nb = other->count / n;
+  double delta = other->mean - into->mean;
+
+  into->power = na * into->power + nb * other->power + na * nb * delta * delta;
+  into->mean  = into->mean + nb * delta;
+  into->min   = other->min < into->min ? other->min : into->min;
+  into->max   = other->max > into->max ? other->max : into->max;
+  into->count += other->count;
+}
+
+void signal_statistics(double* data, long num, signal_stats* stats) {
+
+  if (num <= STATS_BLOCK) {
+    if (num > 0) {
+      block_statistics(data, num, stats);
+    } else {
+      stats->count = 0;
+      stats->mean = stats->power = stats->min = stats->max = 0;
+    }
+    return;
+  }
+
+  // split on a block boundary so the leaves are whole blocks
+  long half = (num / STATS_BLOCK + 1) / 2 * STATS_BLOCK;
+  signal_stats right;
+  signal_statistics(data, half, stats);
+  signal_statistics(data + half, num - half, &right);
+  merge_signal_statistics(stats, &right);
+}
+
+void iq_signal_statistics(double* data, long num, signal_stats* i, signal_stats* q) {
+
+  if (num <= STATS_BLOCK) {
+    if (num > 0) {
+      // each channel's block gathered into cache, then as for real data
+      double re[STATS_BLOCK];
+      double im[STATS_BLOCK];
+      for (long k = 0; k < num; k++) {
+        re[k] = data[2 * k];
+        im[k] = data[2 * k + 1];
+      }
+      block_statistics(re, num, i);
+      block_statistics(im, num, q);
+    } else {
+      i->count = q->count = 0;
+      i->mean = i->power = i->min = i->max = 0;
+      *q = *i;
+    }
+    return;
+  }
+
+  long half = (num / STATS_BLOCK + 1) / 2 * STATS_BLOCK;
+  signal_stats right_i, right_q;
+  iq_signal_statistics(data, half, i, q);
+  iq_signal_statistics(data + 2 * half, num - half, &right_i, &right_q);
+  merge_signal_statistics(i, &right_i);
+  merge_signal_statistics(q, &right_q);
+}
+
+
+/*
+ * WAV export.  Samples are resampled from the signal's rate to the audio
+ * rate by a polyphase filter: for a rate change of up / down, output m
+ * is input time m down / up, computed from the taps of phase
+ * (m down) % up of a low pass designed at up times the input rate, so
+ * only the outputs actually kept are ever computed.  Inputs go through
+ * a WAV_BLOCK window with the last taps - 1 of the previous block in
+ * front; outputs collect in a WAV_BUFFER sample buffer written out as
+ * it fills.  Nothing grows with the length of the signal.
+ */
+
+#define WAV_BLOCK 4096          // input samples per step
+#define WAV_BUFFER 32768        // output samples per write
+#define WAV_TAPS 16             // per phase, per unit of decimation
+#define WAV_CUTOFF 0.45         // of the lower of the two rates
+
+typedef struct wav_header {
+  char riff[4];
+  unsigned int riff_size;
+  char wave[4];
+  char fmt[4];
+  unsigned int fmt_size;
+  unsigned short format;
+  unsigned short channels;
+  unsigned int rate;
+  unsigned int byte_rate;
+  unsigned short block_align;
+  unsigned short bits;
+  char data[4];
+  unsigned int data_size;
+} __attribute__((packed)) wav_header;
+
+static long gcd(long a, long b) {
+  while (b) {
+    long t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+static int wav_write_header(wav_writer* w) {
+  wav_header h = {{'R', 'I', 'F', 'F'}, 36 + 2 * w->frames, {'W', 'A', 'V', 'E'},
+                  {'f', 'm', 't', ' '}, 16, 1, 1, w->rate, 2 * w->rate, 2, 16,
+                  {'d', 'a', 't', 'a'}, 2 * w->frames};
+  if (pwrite(w->fd, &h, sizeof(h), 0) != sizeof(h)) {
+    perror("Write failure");
+    return -1;
+  }
+  return 0;
+}
+
+static int wav_flush(wav_writer* w) {
+  char* cur = (char*)w->out;
+  long left = w->num_out * sizeof(short);
+  while (left > 0) {
+    long n = write(w->fd, cur, left);
+    if (n <= 0) {
+      perror("Write failure");
+      return -1;
+    }
+    cur += n;
+    left -= n;
+  }
+  w->num_out = 0;
+  return 0;
+}
+
+wav_writer* wav_open(char* file, double Fs, int rate, double offset, double scale) {
+
+  wav_writer* w = calloc(1, sizeof(wav_writer));
+  if (!w) {
+    perror("Not enough memory");
+    return 0;
+  }
+  w->fd = -1;
+
+  long in = lrint(Fs);
+  long g = gcd(in, rate);
+  w->rate = rate;
+  w->up = rate / g;
+  w->down = in / g;
+  w->taps = WAV_TAPS * ((w->down + w->up - 1) / w->up);
+  w->offset = offset;
+  w->scale = scale;
+
+  // phase p, tap k of the prototype, reversed so each output is a plain
+  // dot product with the window
+  w->bank = malloc((long)w->up * w->taps * sizeof(double));
+  w->window = calloc(w->taps - 1 + WAV_BLOCK, sizeof(double));
+  w->out = malloc(WAV_BUFFER * sizeof(short));
+  if (!w->bank || !w->window || !w->out) {
+    perror("Not enough memory");
+    wav_close(w);
+    return 0;
+  }
+
+  long length = (long)w->up * w->taps;
+  double center = (length - 1) / 2.0;
+  double fc = WAV_CUTOFF * (in < rate ? in : rate) / ((double)in * w->up);
+  for (long i = 0; i < length; i++) {
+    double t = i - center;
+    double sinc = t == 0 ? 2 * fc : sin(2 * M_PI * fc * t) / (M_PI * t);
+    double hamming = 0.54 - 0.46 * cos(2 * M_PI * i / (length - 1));
+    // gain up, for the up - 1 zeros interpolation puts between inputs
+    double h = w->up * sinc * hamming;
+    w->bank[(i % w->up) * w->taps + (w->taps - 1 - i / w->up)] = h;
+  }
+
+  if ((w->fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+    perror("Cannot open file");
+    wav_close(w);
+    return 0;
+  }
+  // sizes are filled in on close
+  if (wav_write_header(w) || lseek(w->fd, sizeof(wav_header), SEEK_SET) < 0) {
+    wav_close(w);
+    return 0;
+  }
+
+  return w;
+}
+
+int wav_write(wav_writer* w, long num, double* data) {
+
+  int T = w->taps;
+  for (long b = 0; b < num; b += WAV_BLOCK) {
+    int n = num - b < WAV_BLOCK ? num - b : WAV_BLOCK;
+    memcpy(w->window + T - 1, data + b, n * sizeof(double));
+
+    // every output whose newest input is in this block
+    while (1) {
+      long pos = w->next * w->down;
+      long in = pos / w->up;
+      if (in >= w->consumed + n) {
+        break;
+      }
+      double* h = w->bank + (pos % w->up) * T;
+      double* x = w->window + (in - w->consumed);
+      double s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+      int k;
+      for (k = 0; k + 4 <= T; k += 4) {
+        s0 += h[k] * x[k];
+        s1 += h[k + 1] * x[k + 1];
+        s2 += h[k + 2] * x[k + 2];
+        s3 += h[k + 3] * x[k + 3];
+      }
+      for (; k < T; k++) {
+        s0 += h[k] * x[k];
+      }
+      double v = ((s0 + s1) + (s2 + s3) - w->offset) * w->scale;
+      v = v > 32767 ? 32767 : v < -32768 ? -32768 : v;
+      w->out[w->num_out++] = lrint(v);
+      w->next++;
+      w->frames++;
+      if (w->num_out == WAV_BUFFER && wav_flush(w)) {
+        return -1;
+      }
+    }
+
+    memmove(w->window, w->window + n, (T - 1) * sizeof(double));
+    w->consumed += n;
+  }
+  return 0;
+}
+
+int wav_close(wav_writer* w) {
+  int rc = 0;
+  if (w->fd >= 0) {
+    rc = wav_flush(w) || wav_write_header(w) ? -1 : 0;
+    close(w->fd);
+  }
+  free(w->bank);
+  free(w->window);
+  free(w->out);
+  free(w);
+  return rc;
+}
+
+int save_wav_format_signal(char* file, signal* sig, int rate) {
+
+  if (sig->iq) {
+    printf("Cannot save an I/Q signal as mono audio\n");
+    return -1;
+  }
+
+  // DC removed and the largest excursion at 90% of full scale
+  signal_stats st;
+  signal_statistics(sig->data, sig->num_samples, &st);
+  double peak = fmax(st.max - st.mean, st.mean - st.min);
+  double scale = peak > 0 ? 0.9 * 32767 / peak : 1;
+
+  wav_writer* w = wav_open(file, sig->Fs, rate, st.mean, scale);
+  if (!w) {
+    return -1;
+  }
+  if (wav_write(w, sig->num_samples, sig->data)) {
+    wav_close(w);
+    return -1;
+  }
+  long frames = w->frames;
+  if (wav_close(w)) {
+    return -1;
+  }
+
+  printf("Wrote %ld samples at %d Hz\n", frames, rate);
+
+  return 0;
+}
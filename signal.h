@@ -4,10 +4,14 @@
 typedef struct _signal {
   int map_fd;            // >=0 => fd of mapped file
   int num_samples;       // number of samples
+  int iq;                // 1 => complex: data holds num_samples I/Q pairs
   double Fs;            // sample rate
   double* data;         // loaded or mapped data
 } signal;
 
+// Doubles in data: num_samples, or twice that for I/Q
+#define SIGNAL_VALUES(sig) ((long)(sig)->num_samples * ((sig)->iq ? 2 : 1))
+
 signal* allocate_signal(int numsamples, double Fs, int for_mapping);
 void    free_signal(signal* sig);
 
@@ -18,7 +22,65 @@ signal* load_binary_format_signal(char* file);
 int     save_binary_format_signal(char* file, signal* sig);
 
 signal* map_binary_format_signal(char* file);
+// copy-on-write mapping: writes (e.g. DC removal) never reach the file,
+// so several processes can safely map the same capture
+signal* map_private_binary_format_signal(char* file);
 int     unmap_binary_format_signal(signal* sig);
 
+// Complex captures.  The files are the same doubles, I and Q interleaved;
+// load or map them as usual, then signal_to_iq reinterprets the data as
+// num_samples / 2 complex samples at the same Fs, covering -Fs/2..Fs/2.
+// -1 (and no change) if the number of doubles is odd.
+int     signal_to_iq(signal* sig);
+
+// One pass statistics of a signal.  power is the average power about the
+// mean, i.e. the power left after removing the DC component, so nothing
+// has to be rewritten to learn it.
+typedef struct _signal_stats {
+  long   count;
+  double mean;          // DC component
+  double power;         // average power after DC removal (variance)
+  double min;
+  double max;
+} signal_stats;
+
+// Accurate (pairwise) statistics of data[0..num)
+void signal_statistics(double* data, long num, signal_stats* stats);
+// Combine the statistics of two disjoint pieces into into
+void merge_signal_statistics(signal_stats* into, signal_stats* other);
+// Same for num I/Q pairs at data, each channel on its own; the complex
+// DC is i->mean + j q->mean, the power about it i->power + q->power
+void iq_signal_statistics(double* data, long num, signal_stats* i, signal_stats* q);
+
+// Streaming export to 16-bit mono PCM WAV at rate Hz.  Samples x of a
+// signal at Fs are written as (x - offset) * scale, clipped, resampled by
+// a polyphase filter on the way.  Push any amount at a time with
+// wav_write; memory use is fixed, independent of the total.  wav_close
+// fills in the header sizes.
+typedef struct _wav_writer {
+  int fd;
+  int rate;
+  int up;               // resampling by up / down
+  int down;
+  int taps;             // per phase
+  double* bank;         // up phases of taps
+  double* window;       // taps - 1 samples of history, then a block
+  long consumed;        // input samples so far
+  long next;            // next output sample
+  double offset;
+  double scale;
+  short* out;           // output buffer
+  int num_out;
+  long frames;          // output samples so far
+} wav_writer;
+
+wav_writer* wav_open(char* file, double Fs, int rate, double offset, double scale);
+int         wav_write(wav_writer* w, long num, double* data);
+int         wav_close(wav_writer* w);
+
+// The whole signal, DC removed and its peak at 90% of full scale (real
+// signals only)
+int save_wav_format_signal(char* file, signal* sig, int rate);
+
 #endif
 
@@ -0,0 +1,458 @@
+#define _GNU_SOURCE
+#include <sched.h>    // for processor affinity
+#include <unistd.h>   // unix standard apis
+#include <pthread.h>  // pthread api
+#include <math.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <assert.h>
+
+#include "filter.h"
+#include "signal.h"
+#include "timing.h"
+#include "report.h"
+#include "arena.h"
+#include "fft.h"
+
+/*
+ * Short-time band power (spectrogram).
+ *
+ * Instead of one average power per band over the whole capture, compute
+ * the power of every band in every window of window_seconds, one window
+ * every hop_seconds, so a burst that is on for a fraction of a second
+ * stands out in its frames instead of being averaged away.
+ *
+ * Two engines:
+ *
+ *   stft  Hann windowed FFT of each frame; the one-sided |X_k|^2, scaled
+ *         so they sum to the frame's mean square, are added up over the
+ *         bins falling in each band.  Cheap, resolution Fs / window.
+ *   bank  the band pass filter bank of band_scan run over the signal, the
+ *         squared outputs averaged over each frame.  Same filters, so the
+ *         same numbers as band_scan for a frame covering the whole signal.
+ *
+ * Frames are computed in batches, each batch split into contiguous runs
+ * of frames over num_threads pinned threads, and written out as the
+ * batches complete, so memory use does not grow with the capture length
+ * (map the capture with "mmap" for hour-long files).
+ *
+ * Matrix file (-o): a spectrogram_header, then num_frames rows of
+ * num_bands floats (band power, native byte order), row f covering
+ * samples f * hop .. f * hop + window.
+ *
+ * On stdout, for each band in the alien window, how many frames it was
+ * over THRESHOLD times that frame's average band power, and when.
+ */
+
+#define SPECTROGRAM_MAGIC   0x43455053  // "SPEC"
+#define SPECTROGRAM_VERSION 1
+
+typedef struct spectrogram_header {
+  unsigned int magic;
+  unsigned int version;
+  int num_frames;
+  int num_bands;
+  int window;             // samples per frame
+  int hop;                // samples between frame starts
+  double Fs;
+  double bandwidth;       // band b is b * bandwidth .. (b + 1) * bandwidth
+} spectrogram_header;
+
+#define FRAMES_PER_THREAD 256  // frames each thread does per batch
+
+typedef enum {STFT, BANK} spectrogram_engine;
+
+spectrogram_engine engine = STFT;
+int filter_order = 64;
+double window_secs = 0.01;
+double hop_secs = -1;   // default half a window
+char* out_path = 0;
+
+int num_threads;
+int num_processors;
+
+void usage() {
+  printf("usage: spectrogram [-e stft|bank] [-n filter_order] [-w window_seconds] [-s hop_seconds] [-o matrix_file]\n"
+         "                   text|bin|mmap signal_file Fs num_bands num_threads num_processors\n"
+         "  -e  per-frame FFT (default) or band pass filter bank\n"
+         "  -n  filter order for the bank (default 64)\n"
+         "  -w  frame length (default 0.01 s), -s  frame spacing (default half a frame)\n"
+         "  -o  write the frames x bands power matrix here\n");
+}
+
+// What every thread needs for a batch
+typedef struct spectrogram {
+  signal* sig;
+  double dc;
+  int num_bands;
+  double bandwidth;
+  int window;
+  int hop;
+  double* hann;           // stft: window and its energy
+  double hann_energy;
+  int* bin_band;          // stft: band of each bin
+  double* bank;           // bank: num_bands filters of filter_order + 1
+} spectrogram;
+
+typedef struct inputs {
+  int processor;
+  spectrogram* sp;
+  int first_frame;        // frames first_frame .. first_frame + num_frames - 1
+  int num_frames;
+  float* rows;            // their output rows
+  double* scratch;        // per-thread, see scratch_size
+} __attribute__((aligned(64))) inputs;
+
+// Doubles of scratch each thread needs for a run of n frames
+long scratch_size(spectrogram* sp, int n) {
+  if (engine == STFT) {
+    return sp->window + 2 * (sp->window / 2 + 1);
+  }
+  long span = (long)(n - 1) * sp->hop + sp->window;
+  return (filter_order + span) + 2 * (span + 1);
+}
+
+void stft_frames(spectrogram* sp, inputs* in) {
+
+  int W = sp->window;
+  int bins = W / 2 + 1;
+  double* frame = in->scratch;
+  fftw_complex* spec = (fftw_complex*)(frame + W);
+  fftw_plan plan = fft_plan(W, FFT_R2C, frame, spec);
+
+  // |X_k|^2 of the inner bins count twice (negative frequencies), and
+  // Parseval's 1 / W; divided by the window energy this is mean square
+  double scale = 1.0 / (W * sp->hann_energy);
+
+  for (int f = 0; f < in->num_frames; f++) {
+    double* x = sp->sig->data + (long)(in->first_frame + f) * sp->hop;
+    float* row = in->rows + (long)f * sp->num_bands;
+
+    for (int i = 0; i < W; i++) {
+      frame[i] = (x[i] - sp->dc) * sp->hann[i];
+    }
+    fftw_execute_dft_r2c(plan, frame, spec);
+
+    double power[sp->num_bands];
+    memset(power, 0, sizeof(power));
+    for (int k = 0; k < bins; k++) {
+      double p = spec[k][0] * spec[k][0] + spec[k][1] * spec[k][1];
+      int twice = k > 0 && 2 * k < W;
+      power[sp->bin_band[k]] += (twice ? 2 : 1) * p * scale;
+    }
+    for (int b = 0; b < sp->num_bands; b++) {
+      row[b] = power[b];
+    }
+  }
+}
+
+void bank_frames(spectrogram* sp, inputs* in) {
+
+  int N = sp->sig->num_samples;
+  long first = (long)in->first_frame * sp->hop;
+  long span = (long)(in->num_frames - 1) * sp->hop + sp->window;
+
+  // order samples of history (zeros before the start) and the span
+  double* x = in->scratch;
+  double* y = x + filter_order + span;
+  double* prefix = y + span;    // prefix[i] = sum of y[0..i)^2
+  for (long i = 0; i < filter_order + span; i++) {
+    long s = first - filter_order + i;
+    x[i] = s >= 0 && s < N ? sp->sig->data[s] - sp->dc : 0;
+  }
+
+  for (int b = 0; b < sp->num_bands; b++) {
+    convolve_continue(span, x + filter_order, filter_order,
+                      sp->bank + (long)b * (filter_order + 1), y);
+    prefix[0] = 0;
+    for (long i = 0; i < span; i++) {
+      prefix[i + 1] = prefix[i] + y[i] * y[i];
+    }
+    for (int f = 0; f < in->num_frames; f++) {
+      long s = (long)f * sp->hop;
+      in->rows[(long)f * sp->num_bands + b] =
+        (prefix[s + sp->window] - prefix[s]) / sp->window;
+    }
+  }
+}
+
+void* worker(void* arg) {
+  inputs* in = (inputs*)arg;
+
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(in->processor, &set);
+  if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+    perror("Can't setaffinity");
+    exit(-1);
+  }
+
+  if (in->num_frames > 0) {
+    if (engine == STFT) {
+      stft_frames(in->sp, in);
+    } else {
+      bank_frames(in->sp, in);
+    }
+  }
+
+  pthread_exit(NULL);
+}
+
+int write_all(int fd, void* data, long len) {
+  char* cur = (char*)data;
+  while (len > 0) {
+    long n = write(fd, cur, len);
+    if (n <= 0) {
+      perror("Write failure");
+      return -1;
+    }
+    cur += n;
+    len -= n;
+  }
+  return 0;
+}
+
+int main(int argc, char* argv[]) {
+
+  int opt;
+  while ((opt = getopt(argc, argv, "e:n:w:s:o:h")) != -1) {
+    switch (opt) {
+      case 'e':
+        if (!strcmp(optarg, "stft")) {
+          engine = STFT;
+        } else if (!strcmp(optarg, "bank")) {
+          engine = BANK;
+        } else {
+          usage();
+          return -1;
+        }
+        break;
+      case 'n':
+        filter_order = atoi(optarg);
+        break;
+      case 'w':
+        window_secs = atof(optarg);
+        break;
+      case 's':
+        hop_secs = atof(optarg);
+        break;
+      case 'o':
+        out_path = optarg;
+        break;
+      default:
+        usage();
+        return -1;
+    }
+  }
+  argc -= optind - 1;
+  argv += optind - 1;
+
+  if (argc != 7) {
+    usage();
+    return -1;
+  }
+
+  char sig_type  = toupper(argv[1][0]);
+  char* sig_file = argv[2];
+  double Fs      = atof(argv[3]);
+  int num_bands  = atoi(argv[4]);
+  num_threads    = atoi(argv[5]);
+  num_processors = atoi(argv[6]);
+
+  if (hop_secs <= 0) {
+    hop_secs = window_secs / 2;
+  }
+
+  assert(Fs > 0.0);
+  assert(num_bands > 0);
+  assert(filter_order > 0 && !(filter_order & 0x1));
+  assert(window_secs > 0 && hop_secs > 0);
+  assert(num_threads > 0 && num_processors > 0);
+
+  arena* run = arena_create(0, 0);
+  if (!run) {
+    return -1;
+  }
+  arena_set_run(run);
+
+  signal* sig;
+  switch (sig_type) {
+    case 'T':
+      sig = load_text_format_signal(sig_file);
+      break;
+    case 'B':
+      sig = load_binary_format_signal(sig_file);
+      break;
+    case 'M':
+      sig = map_binary_format_signal(sig_file);
+      break;
+    default:
+      printf("Unknown signal type\n");
+      return -1;
+  }
+  if (!sig) {
+    printf("Unable to load or map file\n");
+    return -1;
+  }
+  sig->Fs = Fs;
+
+  spectrogram sp;
+  sp.sig = sig;
+  sp.num_bands = num_bands;
+  sp.bandwidth = (Fs / 2) / num_bands;
+  sp.window = (int)(window_secs * Fs);
+  sp.hop = (int)(hop_secs * Fs);
+  if (sp.hop < 1) {
+    sp.hop = 1;
+  }
+  if (engine == STFT && sp.window < 2 * num_bands) {
+    // every band needs at least one bin
+    sp.window = 2 * num_bands;
+  }
+
+  int N = sig->num_samples;
+  int num_frames = N < sp.window ? 0 : 1 + (N - sp.window) / sp.hop;
+
+  signal_stats stats;
+  signal_statistics(sig->data, N, &stats);
+  sp.dc = stats.mean;
+
+  printf("engine:   %s\n\
+Fs:       %lf Hz\n\
+bands:    %d of %lf Hz\n\
+window:   %d samples (%lf seconds)\n\
+hop:      %d samples (%lf seconds)\n\
+frames:   %d\n",
+         engine == STFT ? "stft" : "bank", Fs, num_bands, sp.bandwidth,
+         sp.window, sp.window / Fs, sp.hop, sp.hop / Fs, num_frames);
+
+  if (engine == STFT) {
+    int bins = sp.window / 2 + 1;
+    sp.hann = run_alloc(sp.window * sizeof(double));
+    sp.bin_band = run_alloc(bins * sizeof(int));
+    sp.hann_energy = 0;
+    for (int i = 0; i < sp.window; i++) {
+      sp.hann[i] = 0.5 - 0.5 * cos(2 * M_PI * i / sp.window);
+      sp.hann_energy += sp.hann[i] * sp.hann[i];
+    }
+    for (int k = 0; k < bins; k++) {
+      int b = (int)(k * Fs / sp.window / sp.bandwidth);
+      sp.bin_band[k] = b < num_bands ? b : num_bands - 1;
+    }
+  } else {
+    sp.bank = run_alloc((long)num_bands * (filter_order + 1) * sizeof(double));
+    for (int b = 0; b < num_bands; b++) {
+      double* c = sp.bank + (long)b * (filter_order + 1);
+      generate_band_pass(Fs, BAND_LOW(b, sp.bandwidth), BAND_HIGH(b, sp.bandwidth),
+                         filter_order, c);
+      hamming_window(filter_order, c);
+    }
+  }
+
+  int out_fd = -1;
+  if (out_path) {
+    if ((out_fd = open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+      perror("Cannot open matrix file");
+      return -1;
+    }
+    spectrogram_header h = {SPECTROGRAM_MAGIC, SPECTROGRAM_VERSION, num_frames, num_bands,
+                            sp.window, sp.hop, Fs, sp.bandwidth};
+    if (write_all(out_fd, &h, sizeof(h))) {
+      return -1;
+    }
+  }
+
+  // one batch of rows and each thread's scratch, reused batch after batch
+  int batch = num_threads * FRAMES_PER_THREAD;
+  float* rows = run_alloc((long)batch * num_bands * sizeof(float));
+  inputs* thread_inputs = run_alloc(num_threads * sizeof(inputs));
+  pthread_t* tid = run_alloc(num_threads * sizeof(pthread_t));
+  for (int i = 0; i < num_threads; i++) {
+    thread_inputs[i].processor = i % num_processors;
+    thread_inputs[i].sp = &sp;
+    thread_inputs[i].scratch = run_alloc(scratch_size(&sp, FRAMES_PER_THREAD) * sizeof(double));
+  }
+
+  // WOW frames per band in the alien window
+  int* wow_frames = calloc(num_bands, sizeof(int));
+  int* wow_first  = malloc(num_bands * sizeof(int));
+  int* wow_last   = malloc(num_bands * sizeof(int));
+
+  double start = get_seconds();
+
+  for (int first = 0; first < num_frames; first += batch) {
+    int n = num_frames - first < batch ? num_frames - first : batch;
+    int per = (n + num_threads - 1) / num_threads;
+
+    for (int i = 0; i < num_threads; i++) {
+      int mine = i * per;
+      thread_inputs[i].first_frame = first + (mine < n ? mine : n);
+      thread_inputs[i].num_frames = mine < n ? (n - mine < per ? n - mine : per) : 0;
+      thread_inputs[i].rows = rows + (long)(mine < n ? mine : n) * num_bands;
+      if (pthread_create(&tid[i], NULL, worker, &thread_inputs[i]) != 0) {
+        perror("Failed to start thread");
+        exit(-1);
+      }
+    }
+    for (int i = 0; i < num_threads; i++) {
+      if (pthread_join(tid[i], NULL) != 0) {
+        perror("join failed");
+        exit(-1);
+      }
+    }
+
+    for (int f = 0; f < n; f++) {
+      float* row = rows + (long)f * num_bands;
+      double avg = 0;
+      for (int b = 0; b < num_bands; b++) {
+        avg += row[b];
+      }
+      avg /= num_bands;
+      for (int b = 0; b < num_bands; b++) {
+        if (in_alien_window(BAND_LOW(b, sp.bandwidth), BAND_HIGH(b, sp.bandwidth)) &&
+            row[b] > THRESHOLD * avg) {
+          if (!wow_frames[b]++) {
+            wow_first[b] = first + f;
+          }
+          wow_last[b] = first + f;
+        }
+      }
+    }
+
+    if (out_fd >= 0 && write_all(out_fd, rows, (long)n * num_bands * sizeof(float))) {
+      return -1;
+    }
+  }
+
+  double elapsed = get_seconds_diff(start);
+
+  int wow = 0;
+  for (int b = 0; b < num_bands; b++) {
+    if (wow_frames[b]) {
+      wow = 1;
+      printf("band %5d %lf to %lf Hz: WOW in %d of %d frames, %lf to %lf seconds\n",
+             b, BAND_LOW(b, sp.bandwidth), BAND_HIGH(b, sp.bandwidth),
+             wow_frames[b], num_frames,
+             (double)wow_first[b] * sp.hop / Fs,
+             ((double)wow_last[b] * sp.hop + sp.window) / Fs);
+    }
+  }
+  printf(wow ? "POSSIBLE ALIENS (see frames above)\n" : "no aliens\n");
+  printf("Spectrogram took %lf seconds by basic timing\n", elapsed);
+
+  if (out_fd >= 0) {
+    close(out_fd);
+  }
+  free(wow_frames);
+  free(wow_first);
+  free(wow_last);
+  free_signal(sig);
+  arena_set_run(0);
+  arena_destroy(run);
+
+  return 0;
+}
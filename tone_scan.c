@@ -0,0 +1,314 @@
+#define _GNU_SOURCE
+#include <sched.h>    // for processor affinity
+#include <unistd.h>   // unix standard apis
+#include <pthread.h>  // pthread api
+#include <math.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <assert.h>
+
+#include "filter.h"
+#include "signal.h"
+#include "timing.h"
+#include "report.h"
+#include "scan.h"
+#include "arena.h"
+
+/*
+ * Tone detector bank.
+ *
+ * Follow-up to a band scan: when the candidate carriers are already
+ * known, measure the power at just those frequencies instead of filtering
+ * whole bands, at O(samples x targets) cost.
+ *
+ * Without -w, one Goertzel transform per target over the whole capture
+ * (scan_tones), the capture split over num_threads threads.  The
+ * resolution is Fs / num_samples, so a target has to be that close to
+ * the carrier.
+ *
+ * With -w, a sliding DFT over windows of window_seconds, evaluated every
+ * hop_seconds, and the strongest window of each target is reported, so a
+ * short burst is not averaged away.  The targets are split over the
+ * threads, each running its own sliding_dft over the whole capture.
+ *
+ * A target is WOW if it is in the alien window and its power is over
+ * TONE_THRESHOLD times the power white noise with all of the signal's
+ * power would put in one DFT bin (2 P / N for N samples).  Noise alone
+ * exceeds k times that with probability e^-k, so the threshold is much
+ * higher than band_scan's.
+ */
+
+#define TONE_THRESHOLD 20.0
+
+double window_secs = 0;   // -w: sliding window, 0 = whole capture
+double hop_secs = -1;     // -s: default a quarter window
+
+int num_threads;
+int num_processors;
+
+void usage() {
+  printf("usage: tone_scan [-w window_seconds] [-s hop_seconds]\n"
+         "                 text|bin|mmap signal_file Fs num_threads num_processors freq [freq ...]\n"
+         "  -w  strongest window of this length instead of the whole capture\n"
+         "  -s  window spacing (default a quarter window)\n");
+}
+
+typedef struct inputs {
+  int processor;
+  signal* sig;
+  double dc;
+  int window;
+  int hop;
+  int num_targets;        // targets first .. first + num_targets - 1
+  double* omega;
+  double* max_power;      // their strongest window
+  long* max_at;           // and the sample it ends at
+} __attribute__((aligned(64))) inputs;
+
+void* worker(void* arg) {
+  inputs* in = (inputs*)arg;
+
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(in->processor, &set);
+  if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+    perror("Can't setaffinity");
+    exit(-1);
+  }
+
+  if (in->num_targets == 0) {
+    pthread_exit(NULL);
+  }
+
+  sliding_dft* s = sliding_dft_create(in->window, in->dc, in->num_targets, in->omega);
+  if (!s) {
+    perror("Not enough memory");
+    exit(-1);
+  }
+
+  double power[in->num_targets];
+  for (int t = 0; t < in->num_targets; t++) {
+    in->max_power[t] = 0;
+    in->max_at[t] = -1;
+  }
+
+  long N = in->sig->num_samples;
+  sliding_dft_push(s, in->window < N ? in->window : N, in->sig->data);
+  for (long end = in->window; end <= N; end += in->hop) {
+    sliding_dft_power(s, power);
+    for (int t = 0; t < in->num_targets; t++) {
+      if (power[t] > in->max_power[t]) {
+        in->max_power[t] = power[t];
+        in->max_at[t] = end;
+      }
+    }
+    int n = end + in->hop <= N ? in->hop : N - end;
+    sliding_dft_push(s, n, in->sig->data + end);
+  }
+
+  sliding_dft_free(s);
+  pthread_exit(NULL);
+}
+
+void scan_windows(signal* sig, double dc, int window, int hop,
+                  int num_targets, double* freqs, double* max_power, long* max_at) {
+
+  pthread_t tid[num_threads];
+  inputs* thread_inputs = run_alloc(num_threads * sizeof(inputs));
+  double* omega = run_alloc(num_targets * sizeof(double));
+  for (int t = 0; t < num_targets; t++) {
+    omega[t] = 2 * M_PI * freqs[t] / sig->Fs;
+  }
+
+  int per_thread = (num_targets + num_threads - 1) / num_threads;
+
+  for (int i = 0; i < num_threads; i++) {
+    int first = i * per_thread < num_targets ? i * per_thread : num_targets;
+    thread_inputs[i].processor = i % num_processors;
+    thread_inputs[i].sig = sig;
+    thread_inputs[i].dc = dc;
+    thread_inputs[i].window = window;
+    thread_inputs[i].hop = hop;
+    thread_inputs[i].num_targets = num_targets - first < per_thread ? num_targets - first : per_thread;
+    thread_inputs[i].omega = omega + first;
+    thread_inputs[i].max_power = max_power + first;
+    thread_inputs[i].max_at = max_at + first;
+    if (pthread_create(&(tid[i]), NULL, worker, &(thread_inputs[i])) != 0) {
+      perror("Failed to start thread");
+      exit(-1);
+    }
+  }
+
+  for (int i = 0; i < num_threads; i++) {
+    if (pthread_join(tid[i], NULL) != 0) {
+      perror("join failed");
+      exit(-1);
+    }
+  }
+
+  run_free(omega);
+  run_free(thread_inputs);
+}
+
+int main(int argc, char* argv[]) {
+
+  int opt;
+  while ((opt = getopt(argc, argv, "w:s:h")) != -1) {
+    switch (opt) {
+      case 'w':
+        window_secs = atof(optarg);
+        break;
+      case 's':
+        hop_secs = atof(optarg);
+        break;
+      default:
+        usage();
+        return -1;
+    }
+  }
+  argc -= optind - 1;
+  argv += optind - 1;
+
+  if (argc < 7) {
+    usage();
+    return -1;
+  }
+
+  char sig_type  = toupper(argv[1][0]);
+  char* sig_file = argv[2];
+  double Fs      = atof(argv[3]);
+  num_threads    = atoi(argv[4]);
+  num_processors = atoi(argv[5]);
+  int num_targets = argc - 6;
+
+  if (hop_secs <= 0) {
+    hop_secs = window_secs / 4;
+  }
+
+  assert(Fs > 0.0);
+  assert(window_secs >= 0);
+  assert(num_threads > 0 && num_processors > 0);
+
+  arena* run = arena_create(0, 0);
+  if (!run) {
+    return -1;
+  }
+  arena_set_run(run);
+
+  double* freqs = run_alloc(num_targets * sizeof(double));
+  for (int t = 0; t < num_targets; t++) {
+    freqs[t] = atof(argv[6 + t]);
+    assert(freqs[t] >= 0 && freqs[t] <= Fs / 2);
+  }
+
+  signal* sig;
+  switch (sig_type) {
+    case 'T':
+      sig = load_text_format_signal(sig_file);
+      break;
+    case 'B':
+      sig = load_binary_format_signal(sig_file);
+      break;
+    case 'M':
+      sig = map_binary_format_signal(sig_file);
+      break;
+    default:
+      printf("Unknown signal type\n");
+      return -1;
+  }
+  if (!sig) {
+    printf("Unable to load or map file\n");
+    return -1;
+  }
+  sig->Fs = Fs;
+
+  long N = sig->num_samples;
+  int window = window_secs > 0 ? (int)(window_secs * Fs) : N;
+  int hop = (int)(hop_secs * Fs);
+  if (window > N) {
+    window = N;
+  }
+  if (hop < 1) {
+    hop = 1;
+  }
+
+  signal_stats stats;
+  scan_statistics(sig, &stats, num_threads, 0, num_processors);
+
+  printf("Fs:       %lf Hz\n\
+targets:  %d\n\
+window:   %d samples (%lf seconds, resolution %lf Hz)\n",
+         Fs, num_targets, window, window / Fs, Fs / window);
+  if (window_secs > 0) {
+    printf("hop:      %d samples (%lf seconds)\n", hop, hop / Fs);
+  }
+  printf("Removing DC component of %lf\n", stats.mean);
+  printf("signal average power:     %lf\n", stats.power);
+
+  double* tone_power = run_alloc(num_targets * sizeof(double));
+  long* tone_at = run_alloc(num_targets * sizeof(long));
+
+  resources rstart;
+  get_resources(&rstart,THIS_PROCESS);
+  double time_start = get_seconds();
+
+  if (window_secs > 0) {
+    scan_windows(sig, stats.mean, window, hop, num_targets, freqs, tone_power, tone_at);
+  } else {
+    scan_tones(sig, stats.mean, num_targets, freqs, tone_power,
+               num_threads, 0, num_processors);
+  }
+
+  double time_end = get_seconds();
+  resources rend;
+  get_resources(&rend,THIS_PROCESS);
+  resources rdiff;
+  get_resources_diff(&rstart, &rend, &rdiff);
+
+  double noise_floor = 2 * stats.power / window;
+  double max_power = 0;
+  for (int t = 0; t < num_targets; t++) {
+    max_power = fmax(max_power, tone_power[t]);
+  }
+
+  int wow = 0;
+  for (int t = 0; t < num_targets; t++) {
+    printf("%5d %20lf Hz: %20lf ", t, freqs[t], tone_power[t]);
+    for (int i = 0; max_power > 0 && i < MAXWIDTH * (tone_power[t] / max_power); i++) {
+      printf("*");
+    }
+    int hit = freqs[t] >= ALIENS_LOW && freqs[t] <= ALIENS_HIGH &&
+              tone_power[t] > TONE_THRESHOLD * noise_floor;
+    wow |= hit;
+    if (window_secs > 0 && tone_at[t] >= 0) {
+      printf("%s at %lf s\n", hit ? "(WOW)" : "(meh)", (tone_at[t] - window) / Fs);
+    } else {
+      printf("%s\n", hit ? "(WOW)" : "(meh)");
+    }
+  }
+  printf("noise floor per bin:      %lf\n", noise_floor);
+
+  report_resources(&rdiff);
+  printf("Analysis took %lf seconds by basic timing\n", time_end - time_start);
+
+  if (wow) {
+    printf("POSSIBLE ALIENS at:");
+    for (int t = 0; t < num_targets; t++) {
+      if (freqs[t] >= ALIENS_LOW && freqs[t] <= ALIENS_HIGH &&
+          tone_power[t] > TONE_THRESHOLD * noise_floor) {
+        printf(" %lf", freqs[t]);
+      }
+    }
+    printf(" HZ\n");
+  } else {
+    printf("no aliens\n");
+  }
+
+  free_signal(sig);
+  arena_destroy(run);
+
+  return 0;
+}